@@ -18,15 +18,319 @@
 #include <cstdlib>      // For random number generation (rand, srand)
 #include <ctime>        // For seeding the random number generator (time)
 #include <chrono>       // For high-resolution clock and timing
+#include <vector>       // For dynamically sized buffers and run lists
+#include <climits>      // For LLONG_MAX sentinel keys
+#include <cstdint>      // For fixed-width key types
+#include <cstring>      // For memcpy and memcmp
+#include <algorithm>    // For sort, min and swap
+#include <random>       // For 32-bit benchmark keys
+#include <map>          // For the containers of roaring bitmaps
+#include <set>          // For the connections the sort service is reading
+#include <sstream>      // For splitting request mixes
+#include <deque>        // For the bounded queues between batch stages
+#include <thread>       // For the dedicated batch pipeline stages
+#include <mutex>        // For guarding the batch queues and memory budget
+#include <condition_variable>  // For blocking full or empty batch queues
+#include <atomic>       // For counters shared between batch stages
+#include <glob.h>       // For expanding batch input patterns
+#include <coroutine>    // For the asynchronous I/O runtime
+#include <sys/mman.h>   // For mapping the io_uring queues
+#include <sys/syscall.h>  // For the io_uring system calls
+#include <linux/io_uring.h>  // For the io_uring queue layout
+#include <sys/socket.h> // For the sockets between distributed workers
+#include <netdb.h>      // For resolving worker addresses
+#include <sys/wait.h>   // For waiting on local worker processes
+#include <sys/un.h>     // For the Unix sockets of the shared-memory sorter
+#include <csignal>      // For the SIGUSR1 state dump
+#if defined(__SSE2__)
+#include <immintrin.h>  // For streaming (non-temporal) stores
+#endif
+#include <sys/stat.h>   // For file sizes in the bandwidth report
+#include <sys/resource.h>  // For the peak resident size reported against --memory-limit
+#include <fcntl.h>      // For open flags of positional writes
+#include <unistd.h>     // For pwrite and close
 #include <omp.h>        // For OpenMP parallelism
 
 #define INFILE "input_numbers.csv"  // Name of the file where generated numbers will be saved
 #define OUTFILE "sorted_numbers.csv"  // Name of the file where sorted numbers will be saved
 #define N 100                       // Default number of random integers to generate
+#define RUN_BUFFER_SIZE (1 << 20)   // Bytes buffered per sorted run while merging
+#define WRITE_BUFFER_SIZE (1 << 20) // Default bytes of formatted output buffered before each write
+#define CACHE_LINE 64               // Bytes per cache line
+#define RADIX_BITS 8                // Default bits of the key consumed by each radix pass
+#define RADIX_BUCKETS (1 << RADIX_BITS)  // Buckets per radix pass with the default digit width
+#define RADIX_PARALLEL_MIN (1 << 16)     // Keys below which the radix sort runs on one thread
+#define AFLAG_INSERTION_MAX 32      // Buckets up to this size are finished by insertion sort in the American flag sort
+#define INCREMENTAL_INSERTION_MAX 32  // Segments up to this size are finished by insertion sort for --head
+#define BITMAP_DENSE_MAX_RANGE (1ull << 28)  // Largest value range "--bitmap" handles with a dense bitmap
+#define ROARING_ARRAY_MAX 4096      // Values a roaring container holds as a sorted array before becoming a bitmap
+#define SET_GALLOP_RATIO 32         // Size ratio from which set operations gallop through the longer input
+#define RADIX_BENCH_N (1 << 24)     // Default number of keys for the radix benchmark
+#define PARSE_CHUNK_BYTES (1 << 20) // Default bytes of CSV parsed by each thread
+#define NETWORK_MAX 16              // Largest input sorted with the sorting network
+#define COUNTING_MAX_RANGE (1 << 20)     // Largest value range sorted with counting sort
+#define FEW_UNIQUE_RATIO 16         // Inputs with fewer than n / FEW_UNIQUE_RATIO distinct values count as few-unique
+#define PRESORTED_RUN_LENGTH 4096   // Average run length from which an input counts as nearly sorted
+#define RADIX_MIN_N (1 << 12)       // Smallest input the planner gives to the radix engine
+#define TUNING_FILE "tuning_profile.txt"  // Machine-specific parameters written by the "tune" subcommand
+#define TUNE_FILE "tune_numbers.csv"      // Scratch file used while tuning the parser
+#define TUNE_N (1 << 22)            // Default number of integers benchmarked by the "tune" subcommand
+#define TUNE_REPS 3                 // Repetitions per benchmarked setting
+#define BANDWIDTH_PROBE_MIN (64 << 20)   // Smallest array used by the bandwidth probe, in bytes
+#define BANDWIDTH_PROBE_MAX (256 << 20)  // Largest array used by the bandwidth probe, in bytes
+#define BANDWIDTH_PROBE_REPS 5      // Repetitions of each bandwidth kernel
+#define PREFETCH_MERGE 32           // Default elements each merged run prefetches ahead
+#define PREFETCH_SCATTER 32         // Default keys the direct radix scatter prefetches ahead
+#define PREFETCH_BENCH_RUNS 256     // Sorted runs merged when benchmarking merge prefetching
+#define ASYNC_QUEUE_DEPTH 64        // Reads and writes an IoReactor keeps in flight
+#define ASYNC_IO_BYTES (1 << 20)    // Bytes per asynchronous read when loading a file
+#define ASYNC_WRITE_BLOCKS 4        // Output blocks an asynchronous BufferedCsvWriter keeps in flight
+#define ASYNC_FILES 8               // Files the --async batch loader reads at once
+#define DIST_OVERSAMPLE 64          // Samples each distributed worker contributes to the splitter choice
+#define DIST_BASE_PORT 47000        // First TCP port of local distributed workers
+#define DIST_CONNECT_TIMEOUT_MS 10000  // How long a worker retries connecting to a peer
+#define SERVICE_WINDOW_US 200       // Default time a small service request waits for others to batch with
+#define SERVICE_LARGE (1 << 16)     // Default request size sent straight to the parallel engine
+#define SERVICE_BATCH_MAX (1 << 20) // Integers in one coalesced batch of small requests
+#define SERVICE_QUEUE_DEPTH 4096    // Requests read ahead of the service dispatcher
+#define SERVICE_MAX_REQUEST (1 << 26)  // Largest service request in integers; a larger header drops the connection
+#define LATENCY_SUB_BITS 8          // Linear buckets per power of two in latency histograms (0.4% precision)
+#define LATENCY_MAX_SHIFT 32        // Powers of two above the linear range covered by latency histograms
+#define PIPELINE_CHUNK (1 << 22)    // Integers parsed and sorted per chunk by --pipeline
+#define PIPELINE_BLOCK (1 << 16)    // Merged integers handed to the --pipeline writer at a time
+#define METRICS_THREADS 256         // Per-thread metric slots; later threads share the last one
+#define METRICS_INTERVAL_MS 1000    // How often --metrics-file is rewritten
+#define METRICS_SCRAPE_TIMEOUT_MS 1000  // How long a --metrics-port client may take to send its request
+#define STATS_FILE "quicksort_stats.txt"  // Default file of the SIGUSR1 state dump
+#define PLAN_ELEMENTS_PER_THREAD (1 << 16)  // Default integers per thread the planner aims for
+#define PROBE_SAMPLES 4096          // Integers sampled to estimate the number of distinct values
+#define PROBE_BLOCKS 64             // Blocks of consecutive integers sampled to estimate the number of runs
+#define PROBE_BLOCK_LENGTH 64       // Integers per sampled block
 
 using namespace std;
 using namespace std::chrono;
 
+/**
+ * @brief Settings selected through command-line flags.
+ */
+struct SortOptions {
+    string engine = "auto";        // Sorting engine, or "auto" to let the planner choose (--engine=)
+    bool write_combining = true;   // Stage radix scatters in cache-line buffers (--no-wc disables)
+    bool streaming_stores = true;  // Flush staged lines with non-temporal stores (--no-nt disables)
+    bool narrow = false;           // Sort offsets from the minimum in the narrowest key width (--narrow)
+    bool roofline = false;         // Report each phase's share of peak memory bandwidth (--roofline)
+    string bitmap;                 // Write distinct values via "auto", "dense" or "roaring" bitmaps (--bitmap[=])
+    bool unique = false;           // Write each distinct value once (--unique)
+    bool unique_counts = false;    // Write "value:count" for each distinct value (--unique=counts)
+    long long head = 0;            // Write only this many smallest integers, 0 for all (--head=k)
+    bool early_emit = false;       // Stream the sorted prefix while quicksort finishes the rest (--early-emit)
+    bool async_io = false;         // Drive batch and external-sort file I/O from an io_uring reactor (--async)
+    bool pipeline = false;         // Overlap parsing, sorting, merging and writing on stage threads (--pipeline)
+    size_t memory_limit = 0;       // Bytes the program may hold at once, 0 for the default (--memory-limit=MiB)
+    string metrics_file;           // File rewritten with Prometheus metrics, empty for none (--metrics-file=)
+    string stats_file = STATS_FILE;  // File the SIGUSR1 state dump is written to (--stats-file=)
+    int metrics_port = 0;          // Local HTTP port serving Prometheus metrics, 0 for none (--metrics-port=)
+};
+
+SortOptions options;
+
+/**
+ * @brief Machine-specific parameters, loaded from the tuning profile written by the "tune" subcommand.
+ */
+struct TuningProfile {
+    int threads = 0;                                // Threads to run with, or 0 for the OpenMP default
+    int quicksort_cutoff = 100;                     // Sub-arrays smaller than this are sorted without new tasks
+    int radix_bits = RADIX_BITS;                    // Bits per radix digit (8 or 11)
+    size_t parse_chunk_bytes = PARSE_CHUNK_BYTES;   // Minimum bytes of CSV parsed by each thread
+    size_t write_buffer_bytes = WRITE_BUFFER_SIZE;  // Bytes of formatted CSV buffered before each write
+    size_t plan_elements_per_thread = PLAN_ELEMENTS_PER_THREAD;  // Integers per thread the planner aims for
+    double peak_bandwidth_gbs = 0;                  // Measured peak memory bandwidth, or 0 if not measured
+    int prefetch_partition = 0;                     // Elements quicksort's scans prefetch ahead, 0 disables
+    int prefetch_merge = PREFETCH_MERGE;            // Elements each merged run prefetches ahead, 0 disables
+    int prefetch_scatter = PREFETCH_SCATTER;        // Keys the radix scatter prefetches ahead, 0 disables
+};
+
+TuningProfile tuning;
+
+/**
+ * @brief Counters one thread adds to for the metrics exposition, on a cache line of their own.
+ * 
+ * Every thread takes a slot the first time it counts something, so the hot paths only make relaxed
+ * atomic adds to a line no other thread writes. Threads beyond METRICS_THREADS share the last slot,
+ * which stays exact because the adds are atomic.
+ */
+struct alignas(CACHE_LINE) ThreadCounters {
+    atomic<uint64_t> elements_sorted{0};  // Integers sorted by engines this thread ran
+    atomic<uint64_t> bytes_parsed{0};     // CSV bytes parsed
+    atomic<uint64_t> bytes_written{0};    // Output bytes written
+    atomic<uint64_t> tasks{0};            // quickSort tasks run
+    atomic<uint64_t> busy_ns{0};          // Time spent inside quickSort tasks
+    atomic<uint64_t> last_active_ns{0};   // metrics_now_ns() of the thread's latest counted work
+};
+
+ThreadCounters thread_counters[METRICS_THREADS];
+atomic<int> metrics_slots_taken(0);
+
+/**
+ * @brief Engines counted by quicksort_sorts_total, in exposition order.
+ */
+const char* const METRIC_ENGINES[] = {"quicksort", "radix", "aflag", "counting", "merge", "network",
+                                      "incremental", "narrow", "batch"};
+atomic<uint64_t> sorts_by_engine[sizeof(METRIC_ENGINES) / sizeof(METRIC_ENGINES[0])];
+atomic<double> last_thread_utilization(0);  // Busy share of the threads in the latest parallel quicksort
+
+/**
+ * @brief Returns the metrics slot of the calling thread.
+ * 
+ * @return ThreadCounters& The thread's counters.
+ */
+inline ThreadCounters& my_counters() {
+    thread_local ThreadCounters* mine = &thread_counters[min(metrics_slots_taken.fetch_add(1), METRICS_THREADS - 1)];
+    return *mine;
+}
+
+/**
+ * @brief Returns a monotonic timestamp for task timing.
+ * 
+ * @return uint64_t Nanoseconds since an arbitrary epoch.
+ */
+inline uint64_t metrics_now_ns() {
+    return (uint64_t)duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @brief Counts a finished quickSort task and the time it ran.
+ * 
+ * @param start The metrics_now_ns() timestamp taken when the task started.
+ */
+inline void count_task(uint64_t start) {
+    ThreadCounters& counters = my_counters();
+    uint64_t now = metrics_now_ns();
+    counters.tasks.fetch_add(1, memory_order_relaxed);
+    counters.busy_ns.fetch_add(now - start, memory_order_relaxed);
+    counters.last_active_ns.store(now, memory_order_relaxed);
+}
+
+/**
+ * @brief Counts one sort by an engine and the integers it sorted.
+ * 
+ * @param engine The engine name; names outside METRIC_ENGINES only count the integers.
+ * @param n The number of integers sorted.
+ */
+void count_sort(const string& engine, size_t n) {
+    my_counters().elements_sorted.fetch_add(n, memory_order_relaxed);
+    for (size_t e = 0; e < sizeof(METRIC_ENGINES) / sizeof(METRIC_ENGINES[0]); e++) {
+        if (engine == METRIC_ENGINES[e]) {
+            sorts_by_engine[e].fetch_add(1, memory_order_relaxed);
+        }
+    }
+}
+
+/**
+ * @brief Returns the time all threads have spent inside quickSort tasks.
+ * 
+ * @return uint64_t The busy time in nanoseconds.
+ */
+uint64_t total_busy_ns() {
+    uint64_t total = 0;
+    for (const ThreadCounters& counters : thread_counters) {
+        total += counters.busy_ns.load(memory_order_relaxed);
+    }
+    return total;
+}
+
+/**
+ * @brief What the program is doing, for the SIGUSR1 stats dump. Only atomics, so the handler can read it.
+ */
+struct PhaseProgress {
+    atomic<const char*> name{"starting"};   // Phase name; always a string literal
+    atomic<uint64_t> started_ns{0};         // metrics_now_ns() when the phase began
+    atomic<uint64_t> done{0};               // Units of the phase finished so far
+    atomic<uint64_t> total{0};              // Units in the whole phase, or 0 if unknown
+    atomic<const char*> unit{""};           // What done and total count; a string literal
+    atomic<bool> counts_parsing{false};     // Whether every CSV byte parsed adds to done
+};
+
+PhaseProgress phase_progress;
+
+/**
+ * @brief Marks the start of a phase for the stats dump and resets its progress.
+ * 
+ * @param name The phase name, which must be a string literal.
+ * @param total The units of work in the phase, or 0 if unknown.
+ * @param unit What the units are, which must be a string literal.
+ */
+void enter_phase(const char* name, uint64_t total = 0, const char* unit = "") {
+    phase_progress.counts_parsing.store(false, memory_order_relaxed);
+    phase_progress.done.store(0, memory_order_relaxed);
+    phase_progress.total.store(total, memory_order_relaxed);
+    phase_progress.unit.store(unit, memory_order_relaxed);
+    phase_progress.started_ns.store(metrics_now_ns(), memory_order_relaxed);
+    phase_progress.name.store(name, memory_order_release);
+}
+
+/**
+ * @brief Marks the start of a phase whose progress is the number of CSV bytes parsed.
+ * 
+ * @param name The phase name, which must be a string literal.
+ * @param total_bytes The bytes the phase will parse, or 0 if unknown.
+ */
+void enter_parsing_phase(const char* name, uint64_t total_bytes) {
+    enter_phase(name, total_bytes, "bytes parsed");
+    phase_progress.counts_parsing.store(true, memory_order_relaxed);
+}
+
+/**
+ * @brief Stamps the calling thread's slot with the current time, for the idle times of the stats dump.
+ * 
+ * @param counters The calling thread's counters.
+ */
+inline void mark_active(ThreadCounters& counters) {
+    counters.last_active_ns.store(metrics_now_ns(), memory_order_relaxed);
+}
+
+/**
+ * @brief Counts CSV bytes parsed by the calling thread, and the phase progress when it counts parsing.
+ * 
+ * @param bytes The number of bytes.
+ */
+inline void count_parsed(uint64_t bytes) {
+    ThreadCounters& counters = my_counters();
+    counters.bytes_parsed.fetch_add(bytes, memory_order_relaxed);
+    mark_active(counters);
+    if (phase_progress.counts_parsing.load(memory_order_relaxed)) {
+        phase_progress.done.fetch_add(bytes, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief Counts output bytes written by the calling thread.
+ * 
+ * @param bytes The number of bytes.
+ */
+inline void count_written(uint64_t bytes) {
+    ThreadCounters& counters = my_counters();
+    counters.bytes_written.fetch_add(bytes, memory_order_relaxed);
+    mark_active(counters);
+}
+
+/**
+ * @brief Cache sizes and processor layout of the machine, read from sysfs at startup.
+ */
+struct CpuTopology {
+    size_t l1d_bytes = 32 << 10;   // Level 1 data cache per core
+    size_t l2_bytes = 1 << 20;     // Level 2 cache per core
+    size_t l3_bytes = 8 << 20;     // Level 3 cache
+    int l3_shared_cpus = 1;        // Logical CPUs sharing one L3
+    int logical_cpus = 1;          // Online logical CPUs
+    int sockets = 1;               // Physical packages
+    int cores_per_socket = 1;      // Physical cores per package
+    int smt_per_core = 1;          // Hardware threads per physical core
+    int numa_nodes = 1;            // NUMA memory nodes
+};
+
+CpuTopology topology;
+
 /**
  * @brief Generates an array of random integers.
  * 
@@ -62,6 +366,7 @@ void write_numbers_to_file(const int* numbers, int n, const string& filename) {
                 outfile << ',';  // Separate numbers with commas
             }
         }
+        count_written((uint64_t)outfile.tellp());
         outfile.close();  // Close the file after writing is complete
         cout << "Numbers written to " << filename << endl;
     } else {
@@ -84,10 +389,13 @@ int read_numbers_from_file(int* numbers, const string& filename) {
     if (infile.is_open()) {
         string line;
         int count = 0;
+        uint64_t bytes = 0;
         while (getline(infile, line, ',')) {  // Read numbers separated by commas
             numbers[count++] = stoi(line);   // Convert string to integer and store in the array
+            bytes += line.size() + 1;
         }
         infile.close();  // Close the file after reading is complete
+        count_parsed(bytes);
         return count;
     } else {
         cerr << "Error opening file " << filename << endl;  // Display an error if the file cannot be opened
@@ -95,6 +403,223 @@ int read_numbers_from_file(int* numbers, const string& filename) {
     }
 }
 
+/**
+ * @brief A lowest-digit radix histogram computed ahead of the sort, e.g. while parsing.
+ * 
+ * The keys are split into contiguous chunks, one per thread, and the histogram of each chunk is kept
+ * separately so the radix sort can use the counts for its first pass without re-reading the keys.
+ */
+struct RadixHistogram {
+    int threads = 0;        // Number of chunks the keys were split into (0 if not computed)
+    vector<size_t> bounds;  // Chunk t holds keys [bounds[t], bounds[t + 1])
+    vector<size_t> counts;  // threads * RADIX_BUCKETS counts of the lowest RADIX_BITS bits
+    int digit_offset = 0;   // Keys with lowest digit d were counted in bucket (d + digit_offset) % RADIX_BUCKETS
+};
+
+/**
+ * @brief The outcome of parsing a CSV file together with the statistics gathered on the way.
+ */
+struct ParseResult {
+    int count = -1;                  // Number of integers read, or -1 if the file could not be read
+    int min_value = INT_MAX;         // Smallest integer read
+    int max_value = INT_MIN;         // Largest integer read
+    RadixHistogram histogram;        // Lowest-digit histogram of every parsing thread
+};
+
+/**
+ * @brief Checks whether a character can be part of an integer in the CSV file.
+ */
+inline bool is_number_char(char c) {
+    return (c >= '0' && c <= '9') || c == '-';
+}
+
+/**
+ * @brief Parses comma-separated integers from text already in memory, in parallel.
+ * 
+ * The text is split at separator boundaries into one chunk per thread, with at least
+ * tuning.parse_chunk_bytes bytes per chunk, and parsed as described for read_numbers_with_histogram.
+ * 
+ * @param text The text to parse, followed by a terminating NUL.
+ * @param numbers A pointer to the array where the parsed integers will be stored.
+ * @param capacity The number of integers the array can hold.
+ * @param filename The name of the file the text came from, for error messages.
+ * @param result Receives the count, range and histogram of the integers parsed.
+ * @return int The number of integers parsed. Returns -1 if they do not fit in the array, or if a number
+ *         has no digits or does not fit in 32 bits.
+ */
+int parse_numbers_with_histogram(const vector<char>& text, int* numbers, int capacity, const string& filename, ParseResult& result) {
+    result = ParseResult();
+    size_t size = text.size() - 1;
+    int threads = (int)max((size_t)1, min((size_t)omp_get_max_threads(), size / tuning.parse_chunk_bytes));
+    vector<size_t> starts(threads + 1);
+    for (int t = 0; t <= threads; t++) {
+        size_t pos = size * t / threads;
+        while (pos > 0 && pos < size && is_number_char(text[pos])) {
+            pos++;  // Move the boundary onto a separator so no number is split
+        }
+        starts[t] = pos;
+    }
+
+    RadixHistogram& histogram = result.histogram;
+    histogram.threads = threads;
+    histogram.bounds.assign(threads + 1, 0);
+    histogram.counts.assign((size_t)threads * RADIX_BUCKETS, 0);
+    int min_value = INT_MAX;
+    int max_value = INT_MIN;
+    bool overflow = false;
+    bool malformed = false;
+
+    #pragma omp parallel num_threads(threads) reduction(min:min_value) reduction(max:max_value) reduction(||:malformed)
+    {
+        int t = omp_get_thread_num();
+        const char* p = text.data() + starts[t];
+        const char* end = text.data() + starts[t + 1];
+
+        // Count the numbers of this chunk to find its offset in the array
+        size_t local_count = 0;
+        bool inside = false;
+        for (const char* q = p; q < end; q++) {
+            bool number = is_number_char(*q);
+            local_count += number && !inside;
+            inside = number;
+        }
+        histogram.bounds[t + 1] = local_count;
+        #pragma omp barrier
+        #pragma omp single
+        {
+            for (int u = 0; u < threads; u++) {
+                histogram.bounds[u + 1] += histogram.bounds[u];
+            }
+            overflow = histogram.bounds[threads] > (size_t)capacity;
+        }
+
+        if (!overflow) {
+            size_t* counts = &histogram.counts[(size_t)t * RADIX_BUCKETS];
+            size_t index = histogram.bounds[t];
+            while (p < end) {
+                while (p < end && !is_number_char(*p)) {
+                    p++;  // Skip separators between numbers
+                }
+                if (p == end) {
+                    break;
+                }
+                bool negative = (*p == '-');
+                if (negative) {
+                    p++;
+                }
+                const char* digits = p;
+                uint64_t magnitude = 0;
+                while (*p >= '0' && *p <= '9') {
+                    if (magnitude <= INT_MAX) {
+                        magnitude = magnitude * 10 + (uint64_t)(*p - '0');  // Stops growing once out of range
+                    }
+                    p++;
+                }
+                malformed = malformed || p == digits || magnitude > (uint64_t)INT_MAX + negative;
+                int value = negative ? (int)(0u - (uint32_t)magnitude) : (int)magnitude;
+                numbers[index++] = value;
+                counts[(unsigned int)value & (RADIX_BUCKETS - 1)]++;
+                min_value = min(min_value, value);
+                max_value = max(max_value, value);
+            }
+        }
+    }
+
+    if (overflow) {
+        cerr << "Error: " << filename << " holds more than " << capacity << " numbers" << endl;
+        return -1;
+    }
+    if (malformed) {
+        cerr << "Error: " << filename << " holds a number that is missing its digits or does not fit in 32 bits" << endl;
+        return -1;
+    }
+    count_parsed(size);
+    result.count = (int)histogram.bounds[threads];
+    result.min_value = min_value;
+    result.max_value = max_value;
+    return result.count;
+}
+
+/**
+ * @brief Reads integers from a CSV file in parallel, computing their radix histogram and range on the fly.
+ * 
+ * The file is loaded in one read and split at separator boundaries into one chunk per thread, with at
+ * least tuning.parse_chunk_bytes bytes per chunk. Each
+ * thread first counts the integers in its chunk to find where they go in the array, then parses them
+ * while accumulating the lowest-digit histogram and the minimum and maximum. When parsing ends the
+ * first radix pass and the key-narrowing stage already have everything they need, saving a full pass
+ * over the array.
+ * 
+ * @param numbers A pointer to the array where the read integers will be stored.
+ * @param capacity The number of integers the array can hold.
+ * @param filename The name of the file to read the integers from.
+ * @param result Receives the count, range and histogram of the integers read.
+ * @return int The number of integers read from the file. Returns -1 if the file could not be read or holds
+ *         a number that has no digits or does not fit in 32 bits.
+ */
+int read_numbers_with_histogram(int* numbers, int capacity, const string& filename, ParseResult& result) {
+    result = ParseResult();
+    ifstream infile(filename, ios::binary | ios::ate);
+    if (!infile.is_open()) {
+        cerr << "Error opening file " << filename << endl;  // Display an error if the file cannot be opened
+        return -1;
+    }
+    size_t size = (size_t)infile.tellg();
+    vector<char> text(size + 1);
+    infile.seekg(0);
+    infile.read(text.data(), size);
+    infile.close();
+    text[size] = '\0';  // Sentinel that terminates the last number
+    return parse_numbers_with_histogram(text, numbers, capacity, filename, result);
+}
+
+/**
+ * @brief Partitions a sub-array around its middle element with Hoare's scheme.
+ * 
+ * Afterwards [low, new_high] holds elements no greater than the pivot, [new_low, high] elements no
+ * smaller, and anything in between equals the pivot and is already in its final place. When
+ * tuning.prefetch_partition is set, both scans prefetch that many elements ahead each time they enter
+ * a new cache line.
+ * 
+ * @param numbers A pointer to the array of integers.
+ * @param low The starting index of the sub-array.
+ * @param high The ending index of the sub-array.
+ * @param new_low Receives the start of the upper part.
+ * @param new_high Receives the end of the lower part.
+ */
+inline void hoare_partition(int* numbers, int low, int high, int& new_low, int& new_high) {
+    int pivot = numbers[(high + low) / 2]; // Select the pivot element
+    new_low = low;
+    new_high = high;
+    int distance = tuning.prefetch_partition;
+    while (new_low <= new_high) {
+        if (distance > 0) {
+            while (numbers[new_low] < pivot) {
+                new_low++;
+                if (((uintptr_t)(numbers + new_low) & (CACHE_LINE - 1)) == 0) {
+                    __builtin_prefetch(numbers + min(new_low + distance, high), 1);
+                }
+            }
+            while (numbers[new_high] > pivot) {
+                new_high--;
+                if (((uintptr_t)(numbers + new_high) & (CACHE_LINE - 1)) == 0) {
+                    __builtin_prefetch(numbers + max(new_high - distance, low), 1);
+                }
+            }
+        } else {
+            while (numbers[new_low] < pivot) new_low++;
+            while (numbers[new_high] > pivot) new_high--;
+        }
+        if (new_low <= new_high) {
+            int tmp = numbers[new_low];
+            numbers[new_low] = numbers[new_high];
+            numbers[new_high] = tmp;
+            new_low++;
+            new_high--;
+        }
+    }
+}
+
 /**
  * @brief Sorts an array of integers using the Quick Sort algorithm.
  * 
@@ -113,22 +638,10 @@ void quickSort(int* numbers, int low, int high) {
     if (low >= high) {
         return; // Base case: If the sub-array has one or no elements, it is already sorted
     }
-    int pivot = numbers[(high + low) / 2]; // Select the pivot element
-    int new_low = low;
-    int new_high = high;
-    while (new_low <= new_high) {
-        while (numbers[new_low] < pivot) new_low++;
-        while (numbers[new_high] > pivot) new_high--;
-        if (new_low <= new_high) {
-            int tmp = numbers[new_low];
-            numbers[new_low] = numbers[new_high];
-            numbers[new_high] = tmp;
-            new_low++;
-            new_high--;
-        }
-    }
+    int new_low, new_high;
+    hoare_partition(numbers, low, high, new_low, new_high);
 
-    int THRESHOLD = 100;
+    int THRESHOLD = tuning.quicksort_cutoff;
     
     if (high - low < THRESHOLD) {
         quickSort(numbers, low, new_high);
@@ -136,73 +649,6233 @@ void quickSort(int* numbers, int low, int high) {
 
     } else {
         #pragma omp task shared(numbers)
-        quickSort(numbers, low, new_high);
+        {
+            uint64_t start = metrics_now_ns();
+            quickSort(numbers, low, new_high);
+            count_task(start);
+        }
 
         #pragma omp task shared(numbers)
-        quickSort(numbers, new_low, high);
+        {
+            uint64_t start = metrics_now_ns();
+            quickSort(numbers, new_low, high);
+            count_task(start);
+        }
     }
 }
 
 /**
- * @brief The main function that drives the program.
+ * @brief Tracks which parts of an array being sorted are final, and how long the final prefix is.
  * 
- * This function generates random integers, writes them to a file, reads them back from the file,
- * sorts them in parallel, and then writes the sorted integers to another file. The number of integers 
- * to generate can be specified via command-line arguments. If no argument is provided, a default value 
- * of 25 is used.
+ * Sorting tasks report the ranges they finish in any order. Ranges that start at the frontier extend
+ * it, and ranges further right wait in an ordered map until the gap before them closes. A consumer
+ * waits for the frontier to pass a position and may then read everything before it.
+ */
+class SortedFrontier {
+public:
+    /**
+     * @brief Starts with nothing finished.
+     * 
+     * @param n The number of elements being sorted.
+     */
+    explicit SortedFrontier(int n) : n(n) {}
+
+    /**
+     * @brief Records that the elements in [begin, end) are in their final places.
+     * 
+     * @param begin The first finished index.
+     * @param end One past the last finished index.
+     */
+    void finish(int begin, int end) {
+        lock_guard<mutex> lock(guard);
+        if (begin != frontier) {
+            pending[begin] = end;
+            return;
+        }
+        frontier = end;
+        for (auto next = pending.find(frontier); next != pending.end(); next = pending.find(frontier)) {
+            frontier = next->second;
+            pending.erase(next);
+        }
+        advanced.notify_one();
+    }
+
+    /**
+     * @brief Waits until the frontier moves past a position.
+     * 
+     * @param position An index no greater than the number of elements.
+     * @return int The frontier, greater than position unless position is the end of the array.
+     */
+    int wait_beyond(int position) {
+        unique_lock<mutex> lock(guard);
+        advanced.wait(lock, [&] { return frontier > position || frontier == n; });
+        return frontier;
+    }
+
+private:
+    int n;
+    int frontier = 0;        // Every index below this one is final
+    map<int, int> pending;   // Finished ranges beyond the frontier, by start
+    mutex guard;
+    condition_variable advanced;
+};
+
+/**
+ * @brief Sorts like quickSort while reporting finished ranges to a frontier.
  * 
- * @param argc The number of command-line arguments.
- * @param argv The command-line arguments.
- * @return int Returns 0 upon successful execution.
+ * Sub-arrays below the task cutoff are sorted sequentially and reported whole; above it, the
+ * elements equal to the pivot are reported as soon as the partition places them.
+ * 
+ * @param numbers A pointer to the array of integers to be sorted.
+ * @param low The starting index of the sub-array to be sorted.
+ * @param high The ending index of the sub-array to be sorted.
+ * @param frontier The frontier receiving the finished ranges.
  */
-int main(int argc, char* argv[]) {
-    srand(time(0));  // Seed the random number generator with the current time
+void quicksort_reporting(int* numbers, int low, int high, SortedFrontier& frontier) {
+    if (low >= high) {
+        if (low == high) {
+            frontier.finish(low, low + 1);
+        }
+        return;
+    }
+    int new_low, new_high;
+    hoare_partition(numbers, low, high, new_low, new_high);
 
-    // Determine the number of integers to generate
-    int n = N;  // Default value of N
+    if (high - low < tuning.quicksort_cutoff) {
+        quickSort(numbers, low, new_high);
+        quickSort(numbers, new_low, high);
+        frontier.finish(low, high + 1);
+    } else {
+        if (new_high + 1 < new_low) {
+            frontier.finish(new_high + 1, new_low);  // Elements equal to the pivot are already final
+        }
+        #pragma omp task shared(numbers, frontier)
+        {
+            uint64_t start = metrics_now_ns();
+            quicksort_reporting(numbers, low, new_high, frontier);
+            count_task(start);
+        }
 
-    if (argc > 1) {
-        string arg = argv[1];
-        try {
-            n = stoi(arg);  // Convert the argument to an integer
-        } catch (exception &err) {
-            cerr << "Error: The number of integers to generate must be an integer." << endl;
-            return 1;  // Exit the program with an error code
+        #pragma omp task shared(numbers, frontier)
+        {
+            uint64_t start = metrics_now_ns();
+            quicksort_reporting(numbers, new_low, high, frontier);
+            count_task(start);
         }
     }
+}
 
-    cout << "Generating " << n << " random integers" << endl;
+/**
+ * @brief Produces the elements of an array in ascending order on demand with incremental quicksort.
+ * 
+ * Unsorted segments are kept on a stack, nearest first. Asking for the next element partitions the
+ * nearest segment until the element at the read position is final, and larger segments are left
+ * untouched until they are reached, so the first k elements cost O(n + k log k) expected time rather
+ * than a full sort. Segments of up to INCREMENTAL_INSERTION_MAX elements are finished by insertion sort.
+ * The array is permuted in place, and what has been read is sorted.
+ */
+class IncrementalSorter {
+public:
+    /**
+     * @brief Starts with the whole array as one unsorted segment.
+     * 
+     * @param numbers A pointer to the array of integers.
+     * @param n The number of integers in the array.
+     */
+    IncrementalSorter(int* numbers, int n) : numbers(numbers), n(n) {
+        if (n > 0) {
+            segments.push_back({0, n});
+        }
+    }
 
-    // Dynamically allocate memory for the array
-    int* numbers = new int[n];  
+    /**
+     * @brief Returns the next smallest element.
+     * 
+     * @param value Receives the element.
+     * @return bool False once every element has been read.
+     */
+    bool next(int& value) {
+        while (!segments.empty() && segments.back().first == pos) {
+            auto [begin, end] = segments.back();
+            segments.pop_back();
+            if (end - begin <= INCREMENTAL_INSERTION_MAX) {
+                for (int i = begin + 1; i < end; i++) {
+                    int key = numbers[i];
+                    int j = i;
+                    for (; j > begin && numbers[j - 1] > key; j--) {
+                        numbers[j] = numbers[j - 1];
+                    }
+                    numbers[j] = key;
+                }
+                break;
+            }
+            int new_low, new_high;
+            hoare_partition(numbers, begin, end - 1, new_low, new_high);
+            if (new_low < end) {
+                segments.push_back({new_low, end});  // Pending pivot region, read after the lower part
+            }
+            if (new_high >= begin) {
+                segments.push_back({begin, new_high + 1});
+            }
+        }
+        if (pos == n) {
+            return false;
+        }
+        value = numbers[pos++];
+        return true;
+    }
 
-    // Record the start time
-    auto start = high_resolution_clock::now();
+private:
+    int* numbers;
+    int n;
+    int pos = 0;                          // Index of the next element to return
+    vector<pair<int, int>> segments;      // Unsorted [begin, end) ranges, the nearest on top
+};
 
-    // Generate random numbers
-    generate_random_numbers(numbers, n);
-    
-    // Write the generated integers to a file
-    write_numbers_to_file(numbers, n, INFILE);
+/**
+ * @brief Copies one full cache line from a staging buffer to its final destination.
+ * 
+ * When streaming stores are enabled the line is written with non-temporal stores, which bypass the
+ * cache and avoid reading the destination line before overwriting it.
+ * 
+ * @param dst A pointer to the cache-line-aligned destination.
+ * @param src A pointer to the cache-line-aligned staging line.
+ * @param streaming Whether to use non-temporal stores.
+ */
+inline void store_cache_line(void* dst, const void* src, bool streaming) {
+#if defined(__SSE2__)
+    if (streaming) {
+        __m128i* d = (__m128i*)dst;
+        const __m128i* s = (const __m128i*)src;
+        _mm_stream_si128(d, _mm_load_si128(s));
+        _mm_stream_si128(d + 1, _mm_load_si128(s + 1));
+        _mm_stream_si128(d + 2, _mm_load_si128(s + 2));
+        _mm_stream_si128(d + 3, _mm_load_si128(s + 3));
+        return;
+    }
+#endif
+    (void)streaming;
+    memcpy(dst, src, CACHE_LINE);
+}
 
-    // Read the generated integers from file
-    int count = read_numbers_from_file(numbers, INFILE);
-    if (count > 0) {
-        // Sort numbers from array in parallel
-        #pragma omp parallel
-        {
-            #pragma omp single
-            quickSort(numbers, 0, count - 1);
+/**
+ * @brief Scatters keys into their radix buckets for one pass of an LSD radix sort.
+ * 
+ * With write combining enabled, each bucket collects keys in a cache-line-sized staging slot. The
+ * slot is aligned to mirror the destination's cache lines, so a full slot maps onto exactly one
+ * destination line and is written in a single (optionally non-temporal) store. With 8-bit digits this
+ * touches 256 staging lines that stay in L1 instead of 256 scattered destination lines and their TLB
+ * entries. A direct scatter prefetches the destination of the key tuning.prefetch_scatter positions
+ * ahead; a staged scatter prefetches its source that far ahead.
+ * 
+ * @tparam Key An unsigned integer key type.
+ * @tparam Bits The number of bits per digit.
+ * @param src A pointer to the keys to scatter.
+ * @param count The number of keys to scatter.
+ * @param dst A pointer to the destination array.
+ * @param positions The destination index of the next key of each bucket. Updated in place.
+ * @param shift The bit position of the digit of this pass.
+ * @param staging A cache-line-aligned buffer of 2^Bits cache lines, or nullptr for a direct scatter.
+ */
+template <typename Key, int Bits>
+void radix_scatter(const Key* src, size_t count, Key* dst, size_t* positions, int shift, Key* staging) {
+    const int buckets = 1 << Bits;
+    const Key mask = (Key)(buckets - 1);
+    size_t distance = (size_t)tuning.prefetch_scatter;
+    if (staging == nullptr) {
+        for (size_t i = 0; i < count; i++) {
+            if (distance > 0 && i + distance < count) {
+                // Warm the destination slot of a key further ahead
+                __builtin_prefetch(dst + positions[(src[i + distance] >> shift) & mask], 1);
+            }
+            Key key = src[i];
+            dst[positions[(key >> shift) & mask]++] = key;
         }
-        // Write the sorted integers to a file
-        write_numbers_to_file(numbers, count, OUTFILE);
+        return;
     }
 
-    // Record the end time
-    auto end = high_resolution_clock::now();
+    const int per_line = CACHE_LINE / sizeof(Key);
+    unsigned char start[buckets];  // First staging slot in use for each bucket
+    unsigned char fill[buckets];   // Next free staging slot for each bucket
+    for (int b = 0; b < buckets; b++) {
+        start[b] = fill[b] = (unsigned char)(((uintptr_t)(dst + positions[b]) % CACHE_LINE) / sizeof(Key));
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (distance > 0 && ((uintptr_t)(src + i) & (CACHE_LINE - 1)) == 0 && i + distance < count) {
+            __builtin_prefetch(src + i + distance);
+        }
+        Key key = src[i];
+        int b = (key >> shift) & mask;
+        Key* line = staging + b * per_line;
+        line[fill[b]++] = key;
+        if (fill[b] == per_line) {
+            if (start[b] == 0) {
+                store_cache_line(dst + positions[b], line, options.streaming_stores);
+            } else {
+                memcpy(dst + positions[b], line + start[b], (per_line - start[b]) * sizeof(Key));
+            }
+            positions[b] += per_line - start[b];
+            start[b] = fill[b] = 0;
+        }
+    }
+    for (int b = 0; b < buckets; b++) {
+        int pending = fill[b] - start[b];  // Flush partially filled lines with ordinary stores
+        memcpy(dst + positions[b], staging + b * per_line + start[b], pending * sizeof(Key));
+        positions[b] += pending;
+    }
+#if defined(__SSE2__)
+    if (options.streaming_stores) {
+        _mm_sfence();  // Make the non-temporal stores visible to the other threads
+    }
+#endif
+}
 
-    // Calculate the elapsed time in seconds as a double
-    duration<double> execution_time = (end - start);
+/**
+ * @brief Sorts unsigned keys using a parallel least-significant-digit radix sort.
+ * 
+ * Each pass builds per-thread digit histograms, turns them into per-thread bucket offsets, and lets
+ * every thread scatter its own contiguous chunk, which keeps the sort stable. Passes in which every
+ * key has the same digit are skipped, so small-valued keys only pay for the digits they use.
+ * 
+ * @tparam Key An unsigned integer key type.
+ * @tparam Bits The number of bits per digit.
+ * @param keys A pointer to the keys to be sorted.
+ * @param buffer A pointer to scratch space for 'n' keys.
+ * @param n The number of keys.
+ * @param key_bits The number of low-order bits that may differ between keys.
+ * @param first_pass An optional precomputed histogram of the lowest RADIX_BITS bits, which replaces the
+ *                   counting step of the first pass and fixes how the keys are split between threads.
+ *                   It is ignored when Bits differs from RADIX_BITS.
+ */
+template <typename Key, int Bits>
+void radix_sort_digits(Key* keys, Key* buffer, size_t n, int key_bits, const RadixHistogram* first_pass) {
+    const int buckets = 1 << Bits;
+    int passes = (key_bits + Bits - 1) / Bits;
+    int max_threads = n < RADIX_PARALLEL_MIN ? 1 : omp_get_max_threads();
+    if (Bits != RADIX_BITS) {
+        first_pass = nullptr;
+    }
+    if (first_pass != nullptr && first_pass->threads > 0) {
+        max_threads = first_pass->threads;
+    }
+    vector<size_t> histograms((size_t)max_threads * buckets);
+    Key* src = keys;
+    Key* dst = buffer;
+    int threads = 1;
+    bool skip = false;
+
+    #pragma omp parallel num_threads(max_threads)
+    {
+        #pragma omp single
+        threads = omp_get_num_threads();
+
+        // A precomputed histogram is only usable if every chunk it describes has a thread
+        bool precomputed = first_pass != nullptr && first_pass->threads == threads;
+        int t = omp_get_thread_num();
+        size_t lo = precomputed ? first_pass->bounds[t] : n * t / threads;
+        size_t hi = precomputed ? first_pass->bounds[t + 1] : n * (t + 1) / threads;
+        Key* staging = nullptr;
+        if (options.write_combining) {
+            staging = (Key*)aligned_alloc(CACHE_LINE, buckets * CACHE_LINE);
+        }
+        Key* my_src = src;
+        Key* my_dst = dst;
+
+        for (int pass = 0; pass < passes; pass++) {
+            int shift = pass * Bits;
+            size_t* hist = &histograms[(size_t)t * buckets];
+            size_t local[buckets] = {0};
+            if (pass == 0 && precomputed) {
+                const size_t* counts = &first_pass->counts[(size_t)t * buckets];
+                for (int b = 0; b < buckets; b++) {
+                    local[b] = counts[(b + first_pass->digit_offset) & (buckets - 1)];
+                }
+            } else {
+                for (size_t i = lo; i < hi; i++) {
+                    local[(my_src[i] >> shift) & (buckets - 1)]++;
+                }
+            }
+            memcpy(hist, local, sizeof(local));
+            #pragma omp barrier
+
+            #pragma omp single
+            {
+                // Convert the histograms into starting offsets, bucket-major then thread-major
+                size_t offset = 0;
+                skip = false;
+                for (int b = 0; b < buckets; b++) {
+                    size_t bucket_total = 0;
+                    for (int u = 0; u < threads; u++) {
+                        size_t c = histograms[(size_t)u * buckets + b];
+                        histograms[(size_t)u * buckets + b] = offset;
+                        offset += c;
+                        bucket_total += c;
+                    }
+                    if (bucket_total == n) {
+                        skip = true;  // Every key shares this digit, so the pass would not move anything
+                    }
+                }
+            }
+
+            if (!skip) {
+                radix_scatter<Key, Bits>(my_src + lo, hi - lo, my_dst, hist, shift, staging);
+                #pragma omp barrier
+                swap(my_src, my_dst);
+            }
+        }
+
+        free(staging);
+        #pragma omp single
+        src = my_src;
+    }
+
+    if (src != keys) {
+        memcpy(keys, src, n * sizeof(Key));
+    }
+}
+
+/**
+ * @brief Sorts unsigned keys using the radix engine with the digit width from the tuning profile.
+ * 
+ * @tparam Key An unsigned integer key type.
+ * @param keys A pointer to the keys to be sorted.
+ * @param buffer A pointer to scratch space for 'n' keys.
+ * @param n The number of keys.
+ * @param key_bits The number of low-order bits that may differ between keys.
+ * @param first_pass An optional precomputed histogram of the lowest RADIX_BITS bits.
+ */
+template <typename Key>
+void radix_sort(Key* keys, Key* buffer, size_t n, int key_bits = sizeof(Key) * 8,
+                const RadixHistogram* first_pass = nullptr) {
+    if (tuning.radix_bits == 11) {
+        radix_sort_digits<Key, 11>(keys, buffer, n, key_bits, first_pass);
+    } else {
+        radix_sort_digits<Key, RADIX_BITS>(keys, buffer, n, key_bits, first_pass);
+    }
+}
+
+/**
+ * @brief Sorts signed integers with the radix engine.
+ * 
+ * Flipping the sign bit maps signed order onto unsigned order, so the integers can be sorted as
+ * unsigned keys in place and flipped back afterwards.
+ * 
+ * @param numbers A pointer to the array of integers to be sorted.
+ * @param n The number of integers in the array.
+ * @param first_pass An optional lowest-digit histogram gathered while parsing. The sign flip does not
+ *                   change the lowest digit, so it applies to the flipped keys unchanged.
+ */
+void radix_sort_numbers(int* numbers, size_t n, const RadixHistogram* first_pass = nullptr) {
+    uint32_t* keys = (uint32_t*)numbers;
+    for (size_t i = 0; i < n; i++) {
+        keys[i] ^= 0x80000000u;
+    }
+    uint32_t* buffer = (uint32_t*)aligned_alloc(CACHE_LINE, (n * sizeof(uint32_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+    radix_sort(keys, buffer, n, 32, first_pass);
+    free(buffer);
+    for (size_t i = 0; i < n; i++) {
+        keys[i] ^= 0x80000000u;
+    }
+}
+
+/**
+ * @brief Sorts integers from a small value range by counting the occurrences of each value.
+ * 
+ * Every thread counts the values of its own chunk, the counts are summed, and the sorted array is
+ * rebuilt by writing each value as many times as it occurred. The work is linear in the number of
+ * integers plus the size of the range.
+ * 
+ * @param numbers A pointer to the array of integers to be sorted.
+ * @param n The number of integers in the array.
+ * @param lo The smallest integer of the array.
+ * @param hi The largest integer of the array.
+ */
+void counting_sort_numbers(int* numbers, size_t n, int lo, int hi) {
+    size_t range = (size_t)((uint32_t)hi - (uint32_t)lo) + 1;
+    int max_threads = n < RADIX_PARALLEL_MIN ? 1 : omp_get_max_threads();
+    vector<unsigned int> counts;
+    vector<size_t> starts(range + 1, 0);
+    int threads = 1;
+
+    #pragma omp parallel num_threads(max_threads)
+    {
+        #pragma omp single
+        {
+            threads = omp_get_num_threads();
+            counts.assign((size_t)threads * range, 0);
+        }
+        int t = omp_get_thread_num();
+        unsigned int* local = &counts[(size_t)t * range];
+        for (size_t i = n * t / threads; i < n * (t + 1) / threads; i++) {
+            local[(uint32_t)numbers[i] - (uint32_t)lo]++;
+        }
+        #pragma omp barrier
+
+        #pragma omp for
+        for (size_t v = 0; v < range; v++) {
+            size_t total = 0;
+            for (int u = 0; u < threads; u++) {
+                total += counts[(size_t)u * range + v];
+            }
+            starts[v + 1] = total;
+        }
+
+        #pragma omp single
+        for (size_t v = 0; v < range; v++) {
+            starts[v + 1] += starts[v];  // Turn the counts into starting positions
+        }
+
+        #pragma omp for schedule(static)
+        for (size_t v = 0; v < range; v++) {
+            int value = (int)((uint32_t)lo + (uint32_t)v);
+            for (size_t i = starts[v]; i < starts[v + 1]; i++) {
+                numbers[i] = value;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Sorts at most NETWORK_MAX integers with a fixed sorting network.
+ * 
+ * The integers are padded to NETWORK_MAX elements with INT_MAX and passed through Batcher's odd-even
+ * merge sort network. Every comparator is a branch-free min/max pair, so tiny inputs avoid the
+ * mispredicted branches and recursion of a general-purpose sort.
+ * 
+ * @param numbers A pointer to the array of integers to be sorted.
+ * @param n The number of integers in the array. Must not exceed NETWORK_MAX.
+ */
+void network_sort_numbers(int* numbers, size_t n) {
+    int values[NETWORK_MAX];
+    for (int i = 0; i < NETWORK_MAX; i++) {
+        values[i] = (size_t)i < n ? numbers[i] : INT_MAX;
+    }
+    for (int p = 1; p < NETWORK_MAX; p *= 2) {
+        for (int k = p; k >= 1; k /= 2) {
+            for (int j = k % p; j + k < NETWORK_MAX; j += 2 * k) {
+                for (int i = 0; i < k && i + j + k < NETWORK_MAX; i++) {
+                    if ((i + j) / (2 * p) == (i + j + k) / (2 * p)) {
+                        int a = values[i + j];
+                        int b = values[i + j + k];
+                        values[i + j] = min(a, b);
+                        values[i + j + k] = max(a, b);
+                    }
+                }
+            }
+        }
+    }
+    memcpy(numbers, values, n * sizeof(int));
+}
+
+/**
+ * @brief Measures the effect of write-combining buffers and streaming stores on the radix scatter.
+ * 
+ * Implements the "bench-radix" subcommand: ./quicksort_final bench-radix [n]. Each variant sorts the
+ * same uniformly distributed 32-bit keys three times and the best time is reported.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon success and 1 on invalid arguments.
+ */
+int bench_radix_command(int argc, char* argv[]) {
+    size_t n = RADIX_BENCH_N;
+    if (argc > 2) {
+        try {
+            n = stoul(argv[2]);
+        } catch (exception &err) {
+            cerr << "Error: The number of keys must be an integer." << endl;
+            return 1;
+        }
+    }
+
+    vector<uint32_t> input(n);
+    mt19937 generator(12345);
+    for (size_t i = 0; i < n; i++) {
+        input[i] = generator();
+    }
+    vector<uint32_t> expected(input);
+    sort(expected.begin(), expected.end());
+
+    uint32_t* keys = (uint32_t*)aligned_alloc(CACHE_LINE, (n * sizeof(uint32_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+    uint32_t* buffer = (uint32_t*)aligned_alloc(CACHE_LINE, (n * sizeof(uint32_t) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+    struct Variant {
+        const char* name;
+        bool write_combining;
+        bool streaming_stores;
+    };
+    const Variant variants[] = {
+        {"direct scatter", false, false},
+        {"write-combining buffers", true, false},
+        {"write-combining + streaming stores", true, true},
+    };
+
+    cout << "Radix sort of " << n << " random 32-bit keys on " << omp_get_max_threads() << " threads" << endl;
+    int status = 0;
+    for (const Variant& variant : variants) {
+        options.write_combining = variant.write_combining;
+        options.streaming_stores = variant.streaming_stores;
+        double best = 1e30;
+        for (int rep = 0; rep < 3; rep++) {
+            memcpy(keys, input.data(), n * sizeof(uint32_t));
+            auto start = high_resolution_clock::now();
+            radix_sort(keys, buffer, n);
+            duration<double> elapsed = high_resolution_clock::now() - start;
+            best = min(best, elapsed.count());
+        }
+        bool correct = memcmp(keys, expected.data(), n * sizeof(uint32_t)) == 0;
+        if (!correct) {
+            status = 1;
+        }
+        // Each pass reads and writes every key once
+        int passes = (32 + tuning.radix_bits - 1) / tuning.radix_bits;
+        double gigabytes = 2.0 * passes * n * sizeof(uint32_t) / 1e9;
+        cout << "  " << variant.name << ": " << best << " seconds, " << gigabytes / best << " GB/s"
+             << (correct ? "" : " (WRONG RESULT)") << endl;
+    }
+    free(keys);
+    free(buffer);
+    return status;
+}
+
+/**
+ * @brief Formats an integer as decimal text.
+ * 
+ * Writes the digits of 'value' (with a leading '-' for negative numbers) starting at 'out'.
+ * The buffer must have room for at least 11 characters.
+ * 
+ * @param out A pointer to the character buffer receiving the digits.
+ * @param value The integer to format.
+ * @return int The number of characters written.
+ */
+int format_int(char* out, int value) {
+    char digits[10];
+    unsigned int magnitude = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+    int len = 0;
+    do {
+        digits[len++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    int pos = 0;
+    if (value < 0) {
+        out[pos++] = '-';
+    }
+    while (len > 0) {
+        out[pos++] = digits[--len];
+    }
+    return pos;
+}
+
+/**
+ * @brief Formats an unsigned 64-bit integer as decimal text.
+ * 
+ * The buffer must have room for at least 20 characters.
+ * 
+ * @param out A pointer to the character buffer receiving the digits.
+ * @param value The integer to format.
+ * @return int The number of characters written.
+ */
+int format_uint64(char* out, uint64_t value) {
+    char digits[20];
+    int len = 0;
+    do {
+        digits[len++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    for (int pos = 0; pos < len; pos++) {
+        out[pos] = digits[len - 1 - pos];
+    }
+    return len;
+}
+
+/**
+ * @brief A coroutine started and resumed by an IoReactor.
+ * 
+ * The coroutine starts suspended; IoReactor::spawn schedules it and destroys it once it finishes.
+ */
+struct IoTask {
+    struct promise_type {
+        IoTask get_return_object() {
+            return IoTask{coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        suspend_always initial_suspend() noexcept {
+            return {};
+        }
+        suspend_always final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            terminate();
+        }
+    };
+
+    coroutine_handle<promise_type> handle;
+};
+
+/**
+ * @brief A single-threaded event loop that runs coroutines awaiting file reads and writes.
+ * 
+ * Reads and writes are queued on an io_uring set up with raw system calls, so one thread keeps up to
+ * ASYNC_QUEUE_DEPTH operations in flight in the kernel and resumes each coroutine when its operation
+ * completes. Where io_uring is unavailable (old kernels, seccomp filters) every operation is performed
+ * with pread/pwrite when it is submitted and its coroutine is resumed on the next turn of the loop, so
+ * callers behave the same, only without the overlap. A reactor belongs to the thread that created it.
+ */
+class IoReactor {
+public:
+    /**
+     * @brief The state of one read or write, shared between its awaiter and the ring.
+     */
+    struct Operation {
+        coroutine_handle<> waiter;  // Coroutine to resume on completion
+        long result = 0;            // Bytes transferred, or a negative errno
+    };
+
+    /**
+     * @brief Sets up the io_uring, falling back to synchronous operations if that fails.
+     */
+    IoReactor() {
+        io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        ring_fd = (int)syscall(__NR_io_uring_setup, ASYNC_QUEUE_DEPTH, &params);
+        if (ring_fd < 0) {
+            return;
+        }
+        sq_bytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_bytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+        if (single) {
+            sq_bytes = cq_bytes = max(sq_bytes, cq_bytes);
+        }
+        sq_ring = (char*)mmap(nullptr, sq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+        cq_ring = single ? sq_ring : (char*)mmap(nullptr, cq_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+        sqes = (io_uring_sqe*)mmap(nullptr, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                                   MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+        if (sq_ring == MAP_FAILED || cq_ring == MAP_FAILED || sqes == (io_uring_sqe*)MAP_FAILED) {
+            close(ring_fd);
+            ring_fd = -1;
+            return;
+        }
+        sq_entries = params.sq_entries;
+        sqe_bytes = params.sq_entries * sizeof(io_uring_sqe);
+        sq_head = (unsigned*)(sq_ring + params.sq_off.head);
+        sq_tail = (unsigned*)(sq_ring + params.sq_off.tail);
+        sq_mask = *(unsigned*)(sq_ring + params.sq_off.ring_mask);
+        sq_array = (unsigned*)(sq_ring + params.sq_off.array);
+        cq_head = (unsigned*)(cq_ring + params.cq_off.head);
+        cq_tail = (unsigned*)(cq_ring + params.cq_off.tail);
+        cq_mask = *(unsigned*)(cq_ring + params.cq_off.ring_mask);
+        cqes = (io_uring_cqe*)(cq_ring + params.cq_off.cqes);
+    }
+
+    ~IoReactor() {
+        run();
+        if (ring_fd >= 0) {
+            munmap(sqes, sqe_bytes);
+            if (cq_ring != sq_ring) {
+                munmap(cq_ring, cq_bytes);
+            }
+            munmap(sq_ring, sq_bytes);
+            close(ring_fd);
+        }
+    }
+
+    /**
+     * @brief Checks whether operations go through io_uring rather than the synchronous fallback.
+     * 
+     * @return bool True if io_uring is in use.
+     */
+    bool uses_io_uring() const {
+        return ring_fd >= 0;
+    }
+
+    /**
+     * @brief Schedules a coroutine; the reactor owns it from now on.
+     * 
+     * @param task The coroutine to run.
+     */
+    void spawn(IoTask task) {
+        live++;
+        ready.push_back(task.handle);
+    }
+
+    /**
+     * @brief Returns the number of spawned coroutines that have not finished.
+     * 
+     * @return size_t The number of live coroutines.
+     */
+    size_t tasks() const {
+        return live;
+    }
+
+    /**
+     * @brief Queues a read or write whose completion resumes op->waiter.
+     * 
+     * @param opcode IORING_OP_READ or IORING_OP_WRITE.
+     * @param fd The file descriptor.
+     * @param buffer The memory to read into or write from.
+     * @param length The number of bytes.
+     * @param offset The file offset.
+     * @param op The operation to complete.
+     */
+    void submit(int opcode, int fd, void* buffer, size_t length, off_t offset, Operation* op) {
+        if (ring_fd < 0) {
+            ssize_t done = opcode == IORING_OP_READ ? pread(fd, buffer, length, offset) : pwrite(fd, buffer, length, offset);
+            op->result = done < 0 ? -errno : (long)done;
+            ready.push_back(op->waiter);
+            return;
+        }
+        unsigned tail = *sq_tail;
+        while (tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) == sq_entries) {
+            enter(1);  // The submission queue is full; wait for the kernel to take entries
+        }
+        unsigned index = tail & sq_mask;
+        io_uring_sqe* sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = (uint8_t)opcode;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)buffer;
+        sqe->len = (unsigned)length;
+        sqe->off = (uint64_t)offset;
+        sqe->user_data = (uint64_t)(uintptr_t)op;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        unsubmitted++;
+        in_flight++;
+    }
+
+    /**
+     * @brief Runs one turn of the loop: resumes ready coroutines, submits queued operations and reaps completions.
+     * 
+     * @param wait Whether to block for a completion when no coroutine is ready.
+     * @return bool True while spawned coroutines remain.
+     */
+    bool run_once(bool wait) {
+        while (!ready.empty()) {
+            coroutine_handle<> handle = ready.front();
+            ready.pop_front();
+            handle.resume();
+            if (handle.done()) {
+                handle.destroy();
+                live--;
+            }
+        }
+        if (ring_fd >= 0 && (unsubmitted > 0 || (wait && in_flight > 0))) {
+            enter(wait && in_flight > 0 ? 1 : 0);
+        }
+        return live > 0;
+    }
+
+    /**
+     * @brief Runs the loop until every spawned coroutine has finished.
+     */
+    void run() {
+        while (run_once(true)) {
+        }
+    }
+
+private:
+    /**
+     * @brief Submits queued entries, optionally waits for completions, and resumes their coroutines.
+     * 
+     * @param min_complete The number of completions to wait for.
+     */
+    void enter(unsigned min_complete) {
+        long rc = syscall(__NR_io_uring_enter, ring_fd, unsubmitted, min_complete,
+                          min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+        if (rc >= 0) {
+            unsubmitted -= (unsigned)rc;
+        }
+        unsigned head = *cq_head;
+        unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            io_uring_cqe* cqe = &cqes[head & cq_mask];
+            Operation* op = (Operation*)(uintptr_t)cqe->user_data;
+            op->result = cqe->res;
+            ready.push_back(op->waiter);
+            in_flight--;
+        }
+        __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    }
+
+    int ring_fd = -1;
+    size_t sq_bytes = 0;
+    size_t cq_bytes = 0;
+    size_t sqe_bytes = 0;
+    char* sq_ring = nullptr;
+    char* cq_ring = nullptr;
+    io_uring_sqe* sqes = nullptr;
+    unsigned sq_entries = 0;
+    unsigned* sq_head = nullptr;
+    unsigned* sq_tail = nullptr;
+    unsigned sq_mask = 0;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned cq_mask = 0;
+    io_uring_cqe* cqes = nullptr;
+    unsigned unsubmitted = 0;       // Entries queued but not yet passed to the kernel
+    size_t in_flight = 0;           // Operations submitted and not yet completed
+    size_t live = 0;                // Spawned coroutines that have not finished
+    deque<coroutine_handle<>> ready;
+};
+
+/**
+ * @brief The awaitable returned by async_read and async_write.
+ */
+struct IoAwaiter {
+    IoReactor& reactor;
+    int opcode;
+    int fd;
+    void* buffer;
+    size_t length;
+    off_t offset;
+    IoReactor::Operation op;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    void await_suspend(coroutine_handle<> handle) {
+        op.waiter = handle;
+        reactor.submit(opcode, fd, buffer, length, offset, &op);
+    }
+    long await_resume() const noexcept {
+        return op.result;
+    }
+};
+
+/**
+ * @brief Reads from a file at an offset without blocking the reactor's thread.
+ * 
+ * @param reactor The reactor running the calling coroutine.
+ * @param fd The file descriptor.
+ * @param buffer The memory to read into.
+ * @param length The largest number of bytes to read.
+ * @param offset The file offset.
+ * @return IoAwaiter An awaitable yielding the bytes read or a negative errno.
+ */
+IoAwaiter async_read(IoReactor& reactor, int fd, void* buffer, size_t length, off_t offset) {
+    return IoAwaiter{reactor, IORING_OP_READ, fd, buffer, length, offset, {}};
+}
+
+/**
+ * @brief Writes to a file at an offset without blocking the reactor's thread.
+ * 
+ * @param reactor The reactor running the calling coroutine.
+ * @param fd The file descriptor.
+ * @param buffer The memory to write.
+ * @param length The number of bytes to write.
+ * @param offset The file offset.
+ * @return IoAwaiter An awaitable yielding the bytes written or a negative errno.
+ */
+IoAwaiter async_write(IoReactor& reactor, int fd, const void* buffer, size_t length, off_t offset) {
+    return IoAwaiter{reactor, IORING_OP_WRITE, fd, (void*)buffer, length, offset, {}};
+}
+
+/**
+ * @brief Loads a whole file into memory with ASYNC_IO_BYTES reads, followed by a terminating NUL.
+ * 
+ * @tparam Done A callable taking a bool.
+ * @param reactor The reactor running the coroutine.
+ * @param filename The name of the file to load.
+ * @param text Receives the contents. Must outlive the coroutine.
+ * @param done Called with false if the file could not be read, or true once it is loaded.
+ * @return IoTask The coroutine, to be passed to reactor.spawn.
+ */
+template <typename Done>
+IoTask async_load_file(IoReactor& reactor, string filename, vector<char>& text, Done done) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat info;
+    bool ok = fd >= 0 && fstat(fd, &info) == 0;
+    size_t size = ok ? (size_t)info.st_size : 0;
+    text.resize(size + 1);
+    for (size_t loaded = 0; ok && loaded < size; ) {
+        long got = co_await async_read(reactor, fd, text.data() + loaded, min(size - loaded, (size_t)ASYNC_IO_BYTES), (off_t)loaded);
+        ok = got > 0;
+        loaded += ok ? (size_t)got : 0;
+    }
+    text[size] = '\0';  // Sentinel that terminates the last number
+    if (fd >= 0) {
+        close(fd);
+    }
+    done(ok);
+}
+
+/**
+ * @brief Writes one block of a BufferedCsvWriter through the reactor and returns it to the free list.
+ * 
+ * @param reactor The reactor running the coroutine.
+ * @param fd The file descriptor.
+ * @param block The text to write.
+ * @param length The number of bytes of the block to write.
+ * @param offset The file offset of the block.
+ * @param free_blocks Receives the block once it is written.
+ * @param failed Set to true if the write fails.
+ * @return IoTask The coroutine, to be passed to reactor.spawn.
+ */
+IoTask async_write_block(IoReactor& reactor, int fd, vector<char>* block, size_t length, off_t offset,
+                         vector<vector<char>*>& free_blocks, bool& failed) {
+    for (size_t done = 0; done < length; ) {
+        long put = co_await async_write(reactor, fd, block->data() + done, length - done, offset + (off_t)done);
+        if (put <= 0) {
+            failed = true;
+            break;
+        }
+        done += (size_t)put;
+    }
+    free_blocks.push_back(block);
+}
+
+/**
+ * @brief Streams integers from a sorted CSV run file through a fixed-size buffer.
+ * 
+ * Each reader keeps only RUN_BUFFER_SIZE bytes of its file in memory, so hundreds of runs can be
+ * merged at once without loading them entirely.
+ */
+class CsvRunReader {
+public:
+    /**
+     * @brief Opens the run file for reading.
+     * 
+     * @param filename The name of the sorted CSV file to read.
+     */
+    explicit CsvRunReader(const string& filename) : infile(filename, ios::binary), buffer(RUN_BUFFER_SIZE) {}
+
+    /**
+     * @brief Checks whether the run file was opened successfully.
+     * 
+     * @return bool True if the file is open.
+     */
+    bool is_open() const {
+        return infile.is_open();
+    }
+
+    /**
+     * @brief Reads the next integer of the run.
+     * 
+     * @param value Receives the integer that was read.
+     * @return bool False once the run is exhausted.
+     */
+    bool next(int& value) {
+        int c = get();
+        while (c == ',' || c == '\n' || c == '\r' || c == ' ') {
+            c = get();  // Skip separators between numbers
+        }
+        if (c < 0 || malformed) {
+            return false;
+        }
+        bool negative = (c == '-');
+        if (negative) {
+            c = get();
+        }
+        bool digits = false;
+        uint64_t magnitude = 0;
+        while (c >= '0' && c <= '9') {
+            if (magnitude <= INT_MAX) {
+                magnitude = magnitude * 10 + (uint64_t)(c - '0');  // Stops growing once out of range
+            }
+            digits = true;
+            c = get();
+        }
+        if (!digits || magnitude > (uint64_t)INT_MAX + negative) {
+            malformed = true;
+            return false;
+        }
+        value = negative ? (int)(0u - (uint32_t)magnitude) : (int)magnitude;
+        return true;
+    }
+
+    /**
+     * @brief Checks whether reading stopped at a number that has no digits or does not fit in 32 bits.
+     * 
+     * @return bool True if the run holds such a number; next() returns false from it on.
+     */
+    bool failed() const {
+        return malformed;
+    }
+
+private:
+    /**
+     * @brief Returns the next character of the file, refilling the buffer when it runs dry.
+     * 
+     * @return int The character read, or -1 at the end of the file.
+     */
+    int get() {
+        if (pos == len) {
+            infile.read(buffer.data(), buffer.size());
+            len = (size_t)infile.gcount();
+            count_parsed(len);
+            pos = 0;
+            if (len == 0) {
+                return -1;
+            }
+        }
+        return (unsigned char)buffer[pos++];
+    }
+
+    ifstream infile;
+    vector<char> buffer;
+    size_t pos = 0;
+    size_t len = 0;
+    bool malformed = false;
+};
+
+/**
+ * @brief Reads integers from a sorted run that already lives in memory.
+ * 
+ * A merge over many runs interleaves more sequential streams than the hardware prefetcher tracks, so
+ * the reader prefetches tuning.prefetch_merge integers ahead each time it enters a new cache line.
+ */
+class ArrayRunReader {
+public:
+    /**
+     * @brief Wraps the half-open range [begin, end) as a run.
+     * 
+     * @param begin A pointer to the first integer of the run.
+     * @param end A pointer one past the last integer of the run.
+     */
+    ArrayRunReader(const int* begin, const int* end) : current(begin), last(end), distance(tuning.prefetch_merge) {}
+
+    /**
+     * @brief Reads the next integer of the run.
+     * 
+     * @param value Receives the integer that was read.
+     * @return bool False once the run is exhausted.
+     */
+    bool next(int& value) {
+        if (current == last) {
+            return false;
+        }
+        if (distance > 0 && ((uintptr_t)current & (CACHE_LINE - 1)) == 0 && last - current > distance) {
+            __builtin_prefetch(current + distance);
+        }
+        value = *current++;
+        return true;
+    }
+
+private:
+    const int* current;
+    const int* last;
+    int distance;
+};
+
+/**
+ * @brief Writes integers to a CSV file through a large formatting buffer.
+ * 
+ * Numbers are formatted directly into memory and written in tuning.write_buffer_bytes blocks, which avoids
+ * the per-element overhead of stream insertion when producing large outputs. Given an IoReactor, full
+ * blocks are written asynchronously, up to ASYNC_WRITE_BLOCKS at a time, while formatting continues.
+ */
+class BufferedCsvWriter {
+public:
+    /**
+     * @brief Opens the output file for writing.
+     * 
+     * @param filename The name of the CSV file to create.
+     * @param reactor An optional reactor, owned by the calling thread, that writes the blocks.
+     */
+    explicit BufferedCsvWriter(const string& filename, IoReactor* reactor = nullptr)
+        : buffer(tuning.write_buffer_bytes), reactor(reactor), filename(filename) {
+        if (reactor != nullptr) {
+            fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        } else {
+            outfile.open(filename, ios::binary);
+        }
+    }
+
+    ~BufferedCsvWriter() {
+        flush();
+        if (reactor != nullptr) {
+            while (free_blocks.size() < blocks.size()) {
+                reactor->run_once(true);  // Wait for the blocks still being written
+            }
+            for (vector<char>* block : blocks) {
+                delete block;
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+            if (failed) {
+                cerr << "Error writing file " << filename << endl;
+            }
+        }
+    }
+
+    /**
+     * @brief Checks whether the output file was opened successfully.
+     * 
+     * @return bool True if the file is open.
+     */
+    bool is_open() const {
+        return reactor != nullptr ? fd >= 0 : outfile.is_open();
+    }
+
+    /**
+     * @brief Appends an integer to the output, preceded by a comma unless it is the first one.
+     * 
+     * @param value The integer to write.
+     */
+    void put(int value) {
+        if (len + 12 > buffer.size()) {
+            flush();
+        }
+        if (written > 0) {
+            buffer[len++] = ',';  // Separate numbers with commas
+        }
+        len += format_int(buffer.data() + len, value);
+        written++;
+    }
+
+    /**
+     * @brief Appends an integer with its number of occurrences, written as "value:count".
+     * 
+     * @param value The integer to write.
+     * @param occurrences The number of times the integer occurred.
+     */
+    void put_count(int value, long long occurrences) {
+        put(value);
+        if (len + 21 > buffer.size()) {
+            flush();
+        }
+        buffer[len++] = ':';
+        len += format_uint64(buffer.data() + len, (uint64_t)occurrences);
+    }
+
+    /**
+     * @brief Ends the output with a newline, so that files written this way can be concatenated.
+     */
+    void end_line() {
+        if (len + 1 > buffer.size()) {
+            flush();
+        }
+        buffer[len++] = '\n';
+    }
+
+    /**
+     * @brief Writes any buffered text to the file.
+     */
+    void flush() {
+        count_written(len);
+        if (len > 0 && reactor != nullptr && fd >= 0) {
+            while (free_blocks.empty() && blocks.size() >= ASYNC_WRITE_BLOCKS) {
+                reactor->run_once(true);  // Every block is in flight; wait for one to return
+            }
+            if (free_blocks.empty()) {
+                blocks.push_back(new vector<char>(buffer.size()));
+                free_blocks.push_back(blocks.back());
+            }
+            vector<char>* block = free_blocks.back();
+            free_blocks.pop_back();
+            block->swap(buffer);  // Hand the filled text to the write and keep formatting into the free block
+            reactor->spawn(async_write_block(*reactor, fd, block, len, offset, free_blocks, failed));
+            reactor->run_once(false);
+            offset += (off_t)len;
+            len = 0;
+        } else if (len > 0) {
+            outfile.write(buffer.data(), len);
+            len = 0;
+        }
+    }
+
+    /**
+     * @brief Returns the number of integers written so far.
+     * 
+     * @return long long The number of integers passed to put().
+     */
+    long long count() const {
+        return written;
+    }
+
+private:
+    ofstream outfile;
+    vector<char> buffer;
+    size_t len = 0;
+    long long written = 0;
+    IoReactor* reactor = nullptr;
+    string filename;
+    int fd = -1;
+    off_t offset = 0;
+    vector<vector<char>*> blocks;       // Every block allocated for asynchronous writes
+    vector<vector<char>*> free_blocks;  // Blocks not being written
+    bool failed = false;
+};
+
+/**
+ * @brief A tournament (loser) tree that repeatedly selects the smallest head among k sorted runs.
+ * 
+ * Internal nodes store the loser of the match played there together with its key, and node 0 stores
+ * the overall winner. Replacing the winner replays a single leaf-to-root path of log2(k) matches, each
+ * reading one contiguous node, instead of the 2*log2(k) comparisons and scattered accesses of a binary
+ * heap. Ties are broken by run index so the merge is stable.
+ * 
+ * @tparam Run A run reader type providing bool next(int&).
+ */
+template <typename Run>
+class LoserTree {
+public:
+    /**
+     * @brief Builds the tree from the first element of every run.
+     * 
+     * @param runs The sorted runs to merge. The readers must outlive the tree.
+     */
+    explicit LoserTree(vector<Run*>& runs) : runs(runs) {
+        leaves = 1;
+        while (leaves < (int)runs.size()) {
+            leaves *= 2;  // Pad the number of leaves to a power of two
+        }
+        nodes.assign(leaves, Node{LLONG_MAX, -1});
+        vector<Node> winners(2 * leaves, Node{LLONG_MAX, -1});
+        for (int i = 0; i < leaves; i++) {
+            winners[leaves + i] = Node{fetch(i), i};
+        }
+        for (int node = leaves - 1; node >= 1; node--) {
+            const Node& left = winners[2 * node];
+            const Node& right = winners[2 * node + 1];
+            if (beats(left, right)) {
+                winners[node] = left;
+                nodes[node] = right;
+            } else {
+                winners[node] = right;
+                nodes[node] = left;
+            }
+        }
+        nodes[0] = winners[1];
+    }
+
+    /**
+     * @brief Checks whether every run has been exhausted.
+     * 
+     * @return bool True if no elements remain.
+     */
+    bool empty() const {
+        return nodes[0].key == LLONG_MAX;
+    }
+
+    /**
+     * @brief Returns the smallest remaining element.
+     * 
+     * @return int The current winner of the tournament.
+     */
+    int top() const {
+        return (int)nodes[0].key;
+    }
+
+    /**
+     * @brief Removes the smallest element and refills its slot from the same run.
+     */
+    void pop() {
+        Node winner{fetch(nodes[0].run), nodes[0].run};
+        for (int node = (leaves + winner.run) / 2; node >= 1; node /= 2) {
+            if (beats(nodes[node], winner)) {
+                swap(nodes[node], winner);  // The stored loser wins this match and moves up
+            }
+        }
+        nodes[0] = winner;
+    }
+
+private:
+    /**
+     * @brief A tree node: the key of a run's current head and the index of that run.
+     */
+    struct Node {
+        long long key;
+        int run;
+    };
+
+    /**
+     * @brief Decides a match between two nodes, breaking ties by run index.
+     */
+    static bool beats(const Node& a, const Node& b) {
+        return a.key < b.key || (a.key == b.key && a.run < b.run);
+    }
+
+    /**
+     * @brief Reads the next key of a run, or LLONG_MAX when the run (or padding leaf) is exhausted.
+     */
+    long long fetch(int run) {
+        int value;
+        if (run >= 0 && run < (int)runs.size() && runs[run]->next(value)) {
+            return value;
+        }
+        return LLONG_MAX;
+    }
+
+    vector<Run*>& runs;
+    vector<Node> nodes;
+    int leaves;
+};
+
+/**
+ * @brief Merges k sorted runs into a single sorted sequence.
+ * 
+ * @tparam Run A run reader type providing bool next(int&).
+ * @tparam Sink An output type providing void put(int).
+ * @param runs The sorted runs to merge.
+ * @param sink The destination receiving the merged sequence.
+ * @return long long The number of integers merged.
+ */
+template <typename Run, typename Sink>
+long long merge_runs(vector<Run*>& runs, Sink& sink) {
+    LoserTree<Run> tree(runs);
+    long long merged = 0;
+    while (!tree.empty()) {
+        sink.put(tree.top());
+        tree.pop();
+        merged++;
+    }
+    return merged;
+}
+
+/**
+ * @brief Appends integers to an array, acting as a merge destination in memory.
+ */
+class ArrayWriter {
+public:
+    /**
+     * @brief Starts writing at the given position.
+     * 
+     * @param out A pointer to the first integer to be written.
+     */
+    explicit ArrayWriter(int* out) : current(out) {}
+
+    /**
+     * @brief Appends an integer to the array.
+     * 
+     * @param value The integer to write.
+     */
+    void put(int value) {
+        *current++ = value;
+    }
+
+private:
+    int* current;
+};
+
+/**
+ * @brief Sorts an array that consists of a few long ascending runs by merging the runs.
+ * 
+ * The natural runs are found in one scan and merged with a loser tree, so nearly sorted inputs cost
+ * O(n log r) for r runs instead of a full sort.
+ * 
+ * @param numbers A pointer to the array of integers to be sorted.
+ * @param n The number of integers in the array.
+ * @return size_t The number of runs that were merged.
+ */
+size_t merge_natural_runs(int* numbers, size_t n) {
+    vector<ArrayRunReader> readers;
+    size_t begin = 0;
+    for (size_t i = 1; i <= n; i++) {
+        if (i == n || numbers[i] < numbers[i - 1]) {
+            readers.emplace_back(numbers + begin, numbers + i);  // A descent ends the current run
+            begin = i;
+        }
+    }
+    if (readers.size() <= 1) {
+        return readers.size();
+    }
+
+    vector<ArrayRunReader*> runs;
+    for (ArrayRunReader& reader : readers) {
+        runs.push_back(&reader);
+    }
+    int* merged = new int[n];
+    ArrayWriter writer(merged);
+    merge_runs(runs, writer);
+    memcpy(numbers, merged, n * sizeof(int));
+    delete[] merged;
+    return runs.size();
+}
+
+/**
+ * @brief Merges sorted CSV files into one sorted CSV file.
+ * 
+ * Implements the "merge" subcommand: ./quicksort_final merge <output> <run1> <run2> ...
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon success and 1 if a file could not be opened or holds an invalid number.
+ */
+int merge_command(int argc, char* argv[]) {
+    if (argc < 4) {
+        cerr << "Usage: " << argv[0] << " merge <output.csv> <run1.csv> <run2.csv> ..." << endl;
+        return 1;
+    }
+    auto start = high_resolution_clock::now();
+
+    vector<CsvRunReader*> runs;
+    bool opened = true;
+    for (int i = 3; i < argc; i++) {
+        runs.push_back(new CsvRunReader(argv[i]));
+        if (!runs.back()->is_open()) {
+            cerr << "Error opening file " << argv[i] << endl;
+            opened = false;
+        }
+    }
+
+    long long merged = 0;
+    if (opened) {
+        BufferedCsvWriter writer(argv[2]);
+        if (writer.is_open()) {
+            merged = merge_runs(runs, writer);
+            cout << "Merged " << merged << " numbers from " << runs.size() << " runs into " << argv[2] << endl;
+            for (size_t i = 0; i < runs.size(); i++) {
+                if (runs[i]->failed()) {
+                    cerr << "Error: " << argv[i + 3] << " holds a number that is missing its digits or does not fit in 32 bits" << endl;
+                    opened = false;
+                }
+            }
+        } else {
+            cerr << "Error opening file " << argv[2] << endl;
+            opened = false;
+        }
+    }
+    for (CsvRunReader* run : runs) {
+        delete run;
+    }
+
+    auto end = high_resolution_clock::now();
+    duration<double> execution_time = (end - start);
+    cout << "Execution time: " << execution_time.count() << " seconds" << endl;
+    return opened ? 0 : 1;
+}
+
+/**
+ * @brief Writes the distinct integers of a sorted array to a CSV file, optionally with their counts.
+ * 
+ * Deduplication is fused with formatting and done in parallel. Each thread marks the run heads
+ * (elements that differ from their predecessor) in its chunk, and a prefix sum over the per-thread
+ * head counts gives every distinct value its output position. Each thread then formats its values
+ * into a private buffer. A second prefix sum over the buffer sizes gives each thread its byte offset,
+ * so the buffers are written concurrently with pwrite. With counts, every value is written as
+ * "value:count". A run that continues into later chunks is counted up to the first head after the
+ * thread's chunk.
+ * 
+ * @param numbers A pointer to the sorted array of integers.
+ * @param n The number of integers in the array.
+ * @param filename The name of the file where the distinct integers will be written.
+ * @param counts Whether to append the number of occurrences to each value.
+ * @return long long The number of distinct integers written, or -1 if the file could not be written.
+ */
+long long write_unique_numbers_to_file(const int* numbers, size_t n, const string& filename, bool counts) {
+    int fd = open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        cerr << "Error opening file " << filename << endl;  // Display an error if the file cannot be opened
+        return -1;
+    }
+    int max_threads = n < RADIX_PARALLEL_MIN ? 1 : omp_get_max_threads();
+    vector<size_t> first_head(max_threads + 1, n);  // Index of the first run head of each chunk
+    vector<size_t> heads(max_threads + 1, 0);       // Prefix sums of the run heads per chunk
+    vector<size_t> bytes(max_threads + 1, 0);       // Prefix sums of the formatted bytes per chunk
+    vector<size_t> next_head(max_threads, n);       // First run head after each chunk
+    int threads = 1;
+    bool failed = false;
+
+    #pragma omp parallel num_threads(max_threads)
+    {
+        #pragma omp single
+        threads = omp_get_num_threads();
+        int t = omp_get_thread_num();
+        size_t lo = n * t / threads;
+        size_t hi = n * (t + 1) / threads;
+
+        size_t local_heads = 0;
+        for (size_t i = lo; i < hi; i++) {
+            if (i == 0 || numbers[i] != numbers[i - 1]) {
+                if (local_heads++ == 0) {
+                    first_head[t] = i;
+                }
+            }
+        }
+        heads[t + 1] = local_heads;
+        #pragma omp barrier
+
+        #pragma omp single
+        {
+            for (int u = 0; u < threads; u++) {
+                heads[u + 1] += heads[u];
+            }
+            size_t following = n;
+            for (int u = threads - 1; u >= 0; u--) {
+                next_head[u] = following;
+                following = min(following, first_head[u]);
+            }
+        }
+
+        vector<char> text(local_heads * (counts ? 33 : 12));
+        size_t len = 0;
+        size_t ordinal = heads[t];
+        size_t i = local_heads > 0 ? first_head[t] : hi;
+        while (i < hi) {
+            size_t j = i + 1;
+            while (j < hi && numbers[j] == numbers[i]) {
+                j++;
+            }
+            size_t run_end = j == hi ? next_head[t] : j;
+            if (ordinal++ > 0) {
+                text[len++] = ',';  // Separate numbers with commas
+            }
+            len += format_int(text.data() + len, numbers[i]);
+            if (counts) {
+                text[len++] = ':';
+                len += format_uint64(text.data() + len, run_end - i);
+            }
+            i = j;
+        }
+        bytes[t + 1] = len;
+        #pragma omp barrier
+
+        #pragma omp single
+        for (int u = 0; u < threads; u++) {
+            bytes[u + 1] += bytes[u];
+        }
+
+        count_written(len);
+        if (len > 0 && pwrite(fd, text.data(), len, (off_t)bytes[t]) != (ssize_t)len) {
+            #pragma omp atomic write
+            failed = true;
+        }
+    }
+
+    close(fd);
+    if (failed) {
+        cerr << "Error writing file " << filename << endl;
+        return -1;
+    }
+    cout << "Unique: " << heads[threads] << " distinct values of " << n << " numbers written to " << filename << endl;
+    return (long long)heads[threads];
+}
+
+/**
+ * @brief Loads a sorted file of integers into memory and removes its duplicates.
+ * 
+ * Files ending in ".bin" hold raw native 32-bit integers; any other file is parsed as CSV with the
+ * parallel parser. Set operations treat their inputs as sets, so duplicate values are collapsed.
+ * 
+ * @param filename The name of the file to load.
+ * @param values Receives the distinct integers of the file in ascending order.
+ * @return bool False if the file could not be read or is not sorted.
+ */
+bool load_sorted_set(const string& filename, vector<int>& values) {
+    struct stat info;
+    if (stat(filename.c_str(), &info) != 0) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    size_t size = (size_t)info.st_size;
+    if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".bin") == 0) {
+        values.resize(size / sizeof(int));
+        ifstream infile(filename, ios::binary);
+        infile.read((char*)values.data(), (streamsize)(values.size() * sizeof(int)));
+        if (!infile) {
+            cerr << "Error reading file " << filename << endl;
+            return false;
+        }
+    } else {
+        if (size / 2 + 1 > (size_t)INT_MAX) {
+            cerr << "Error: " << filename << " is too large to parse" << endl;
+            return false;
+        }
+        values.resize(size / 2 + 1);  // Every number takes at least one digit and one separator
+        ParseResult parsed;
+        int count = read_numbers_with_histogram(values.data(), (int)values.size(), filename, parsed);
+        if (count < 0) {
+            return false;
+        }
+        values.resize(count);
+    }
+    if (!is_sorted(values.begin(), values.end())) {
+        cerr << "Error: " << filename << " is not sorted" << endl;
+        return false;
+    }
+    values.erase(unique(values.begin(), values.end()), values.end());
+    return true;
+}
+
+/**
+ * @brief Finds the first position of a sorted range holding a value not less than the key.
+ * 
+ * The search gallops from the start of the range in doubling steps and then binary searches the last
+ * step, so a key near the start costs O(log distance) rather than O(log n).
+ * 
+ * @param values A pointer to the sorted range.
+ * @param n The length of the range.
+ * @param key The value to search for.
+ * @return size_t The index of the first value not less than key, or n if there is none.
+ */
+size_t gallop_lower_bound(const int* values, size_t n, int key) {
+    size_t step = 1;
+    size_t high = 0;
+    while (high < n && values[high] < key) {
+        high += step;
+        step *= 2;
+    }
+    size_t low = high >= step ? high - step / 2 : 0;  // The last index known to hold a smaller value
+    return lower_bound(values + low, values + min(high, n), key) - values;
+}
+
+/**
+ * @brief Intersects or subtracts two strictly increasing ranges.
+ * 
+ * When one range is more than SET_GALLOP_RATIO times longer than the other, each value of the
+ * shorter range is searched for by galloping through the longer one. Otherwise both ranges are
+ * walked in blocks of four: every block of a is compared against all four rotations of the
+ * current block of b, which yields the lanes of a that occur in b, and the block with the smaller
+ * last value is advanced. Matches accumulate for the current block of a until it is left, so the
+ * difference can emit the lanes that never matched.
+ * 
+ * @param a A pointer to the first range.
+ * @param na The length of the first range.
+ * @param b A pointer to the second range.
+ * @param nb The length of the second range.
+ * @param difference Whether to keep the values of a missing from b instead of those present in b.
+ * @param out Receives the resulting values in ascending order.
+ */
+void intersect_ranges(const int* a, size_t na, const int* b, size_t nb, bool difference, vector<int>& out) {
+    if (na * SET_GALLOP_RATIO < nb) {
+        size_t j = 0;
+        for (size_t i = 0; i < na; i++) {
+            j += gallop_lower_bound(b + j, nb - j, a[i]);
+            if ((j < nb && b[j] == a[i]) != difference) {
+                out.push_back(a[i]);
+            }
+        }
+        return;
+    }
+    if (nb * SET_GALLOP_RATIO < na) {
+        size_t i = 0;
+        for (size_t j = 0; j < nb; j++) {
+            size_t k = i + gallop_lower_bound(a + i, na - i, b[j]);
+            if (difference) {
+                out.insert(out.end(), a + i, a + k);  // Values skipped over are missing from b
+                i = k < na && a[k] == b[j] ? k + 1 : k;
+            } else {
+                if (k < na && a[k] == b[j]) {
+                    out.push_back(b[j]);
+                }
+                i = k;
+            }
+        }
+        if (difference) {
+            out.insert(out.end(), a + i, a + na);
+        }
+        return;
+    }
+
+    size_t i = 0;
+    size_t j = 0;
+    int matched = 0;  // Lanes of the current block of a found in b so far
+#if defined(__SSE2__)
+    while (i + 4 <= na && j + 4 <= nb) {
+        __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        __m128i vb = _mm_loadu_si128((const __m128i*)(b + j));
+        __m128i eq = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(va, vb), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x39))),
+            _mm_or_si128(_mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x4E)), _mm_cmpeq_epi32(va, _mm_shuffle_epi32(vb, 0x93))));
+        matched |= _mm_movemask_ps(_mm_castsi128_ps(eq));
+        int a_last = a[i + 3];
+        int b_last = b[j + 3];
+        if (a_last <= b_last) {
+            int keep = difference ? ~matched & 0xF : matched;
+            while (keep) {
+                out.push_back(a[i + __builtin_ctz(keep)]);
+                keep &= keep - 1;
+            }
+            matched = 0;
+            i += 4;
+        }
+        if (b_last <= a_last) {
+            j += 4;
+        }
+    }
+#endif
+    // Finish with a scalar merge; lanes of a already matched above are never found again in b
+    for (size_t start = i; i < na; i++) {
+        if (i - start < 4 && (matched >> (i - start) & 1)) {
+            if (!difference) {
+                out.push_back(a[i]);
+            }
+            continue;
+        }
+        while (j < nb && b[j] < a[i]) {
+            j++;
+        }
+        if ((j < nb && b[j] == a[i]) != difference) {
+            out.push_back(a[i]);
+        }
+    }
+}
+
+/**
+ * @brief Merges two strictly increasing ranges into their union.
+ * 
+ * @param a A pointer to the first range.
+ * @param na The length of the first range.
+ * @param b A pointer to the second range.
+ * @param nb The length of the second range.
+ * @param out Receives the union in ascending order.
+ */
+void union_ranges(const int* a, size_t na, const int* b, size_t nb, vector<int>& out) {
+    size_t i = 0;
+    size_t j = 0;
+    while (i < na && j < nb) {
+        int value = min(a[i], b[j]);
+        out.push_back(value);
+        i += a[i] == value;
+        j += b[j] == value;
+    }
+    out.insert(out.end(), a + i, a + na);
+    out.insert(out.end(), b + j, b + nb);
+}
+
+/**
+ * @brief Runs a set operation between two sorted files and writes the result.
+ * 
+ * Implements the "set" subcommand: ./quicksort_final set <intersect|union|diff> <output> <a> <b>.
+ * Both inputs are split on the same value boundaries, taken at equal steps through the longer input
+ * and located in the shorter one by binary search, so every thread works on matching slices. The
+ * per-thread results are concatenated and written as CSV, or as raw integers if the output ends in ".bin".
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon success and 1 on an error.
+ */
+int set_command(int argc, char* argv[]) {
+    string op = argc == 6 ? argv[2] : "";
+    if (op != "intersect" && op != "union" && op != "diff") {
+        cerr << "Usage: " << argv[0] << " set <intersect|union|diff> <output> <a> <b>" << endl;
+        return 1;
+    }
+    auto start = high_resolution_clock::now();
+    vector<int> a;
+    vector<int> b;
+    if (!load_sorted_set(argv[4], a) || !load_sorted_set(argv[5], b)) {
+        return 1;
+    }
+
+    const vector<int>& longer = a.size() >= b.size() ? a : b;
+    size_t total = a.size() + b.size();
+    int threads = total < RADIX_PARALLEL_MIN ? 1 : omp_get_max_threads();
+    vector<size_t> a_bounds(threads + 1, a.size());
+    vector<size_t> b_bounds(threads + 1, b.size());
+    a_bounds[0] = 0;
+    b_bounds[0] = 0;
+    for (int t = 1; t < threads; t++) {
+        int splitter = longer[longer.size() * t / threads];
+        a_bounds[t] = lower_bound(a.begin(), a.end(), splitter) - a.begin();
+        b_bounds[t] = lower_bound(b.begin(), b.end(), splitter) - b.begin();
+    }
+
+    vector<vector<int>> parts(threads);
+    #pragma omp parallel for num_threads(threads) schedule(static, 1)
+    for (int t = 0; t < threads; t++) {
+        const int* pa = a.data() + a_bounds[t];
+        const int* pb = b.data() + b_bounds[t];
+        size_t na = a_bounds[t + 1] - a_bounds[t];
+        size_t nb = b_bounds[t + 1] - b_bounds[t];
+        if (op == "union") {
+            union_ranges(pa, na, pb, nb, parts[t]);
+        } else {
+            intersect_ranges(pa, na, pb, nb, op == "diff", parts[t]);
+        }
+    }
+
+    string output = argv[3];
+    size_t written = 0;
+    if (output.size() > 4 && output.compare(output.size() - 4, 4, ".bin") == 0) {
+        ofstream outfile(output, ios::binary);
+        for (const vector<int>& part : parts) {
+            outfile.write((const char*)part.data(), (streamsize)(part.size() * sizeof(int)));
+            written += part.size();
+        }
+        if (!outfile) {
+            cerr << "Error opening file " << output << endl;
+            return 1;
+        }
+    } else {
+        BufferedCsvWriter writer(output);
+        if (!writer.is_open()) {
+            cerr << "Error opening file " << output << endl;
+            return 1;
+        }
+        for (const vector<int>& part : parts) {
+            for (int value : part) {
+                writer.put(value);
+            }
+        }
+        written = (size_t)writer.count();
+    }
+    cout << "Set " << op << " of " << a.size() << " and " << b.size() << " distinct values: " << written
+         << " values written to " << output << endl;
+
+    auto end = high_resolution_clock::now();
+    duration<double> execution_time = (end - start);
+    cout << "Execution time: " << execution_time.count() << " seconds" << endl;
+    return 0;
+}
+
+/**
+ * @brief Finds the smallest and largest integers of an array.
+ * 
+ * @param numbers A pointer to the array of integers.
+ * @param n The number of integers in the array. Must be at least 1.
+ * @param lo Receives the smallest integer.
+ * @param hi Receives the largest integer.
+ */
+void find_min_max(const int* numbers, size_t n, int& lo, int& hi) {
+    int min_value = INT_MAX;
+    int max_value = INT_MIN;
+    #pragma omp parallel for reduction(min:min_value) reduction(max:max_value) if(n >= RADIX_PARALLEL_MIN)
+    for (size_t i = 0; i < n; i++) {
+        min_value = min(min_value, numbers[i]);
+        max_value = max(max_value, numbers[i]);
+    }
+    lo = min_value;
+    hi = max_value;
+}
+
+/**
+ * @brief Sorts integers as narrow offsets from a base value and writes them to a CSV file.
+ * 
+ * Each integer is replaced by its offset from 'base', packed into the first n * sizeof(Key) bytes of
+ * the array. For 8- and 16-bit keys the radix sort's scratch space fits in the rest of the array, so
+ * the stage needs no extra memory. The base is added back while the output is formatted.
+ * 
+ * @tparam Key The unsigned key type (uint8_t, uint16_t or uint32_t).
+ * @param numbers A pointer to the array of integers. Its contents are overwritten with packed keys.
+ * @param n The number of integers in the array.
+ * @param base The smallest integer of the array.
+ * @param key_bits The number of bits needed to represent the largest offset.
+ * @param filename The name of the file where the sorted integers will be written.
+ * @param first_pass An optional lowest-digit histogram of the original integers.
+ */
+template <typename Key>
+void narrow_sort_and_write(int* numbers, size_t n, int base, int key_bits, const string& filename,
+                           const RadixHistogram* first_pass) {
+    unsigned char* bytes = (unsigned char*)numbers;
+    for (size_t i = 0; i < n; i++) {
+        Key key = (Key)((uint32_t)numbers[i] - (uint32_t)base);
+        memcpy(bytes + i * sizeof(Key), &key, sizeof(Key));  // Never overwrites an unread integer
+    }
+    Key* keys = (Key*)numbers;
+
+    Key* scratch = nullptr;
+    if (2 * sizeof(Key) <= sizeof(int)) {
+        scratch = keys + n;  // Reuse the now unused upper part of the array
+        radix_sort(keys, scratch, n, key_bits, first_pass);
+    } else {
+        scratch = (Key*)aligned_alloc(CACHE_LINE, (n * sizeof(Key) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE);
+        radix_sort(keys, scratch, n, key_bits, first_pass);
+        free(scratch);
+    }
+
+    BufferedCsvWriter writer(filename);
+    if (writer.is_open() && options.unique) {
+        for (size_t i = 0; i < n; ) {
+            size_t j = i + 1;
+            while (j < n && keys[j] == keys[i]) {
+                j++;  // Collapse the run of equal keys
+            }
+            int value = (int)((uint32_t)base + keys[i]);
+            if (options.unique_counts) {
+                writer.put_count(value, (long long)(j - i));
+            } else {
+                writer.put(value);
+            }
+            i = j;
+        }
+        writer.flush();
+        cout << "Unique: " << writer.count() << " distinct values of " << n << " numbers written to " << filename << endl;
+    } else if (writer.is_open()) {
+        for (size_t i = 0; i < n; i++) {
+            writer.put((int)((uint32_t)base + keys[i]));  // Widen back to the original value
+        }
+        writer.flush();
+        cout << "Numbers written to " << filename << endl;
+    } else {
+        cerr << "Error opening file " << filename << endl;  // Display an error if the file cannot be opened
+    }
+}
+
+/**
+ * @brief Sorts integers in the smallest key width that holds their range and writes them to a CSV file.
+ * 
+ * The minimum is subtracted from every integer so that, for example, values in [0, 999] are sorted as
+ * 10-bit keys in 16-bit storage: two radix passes over half the bytes instead of four over full ints.
+ * 
+ * When the integers were parsed with read_numbers_with_histogram, their range and lowest-digit
+ * histogram are reused instead of scanning the array again. Subtracting the minimum rotates the
+ * lowest digit by the minimum's lowest digit, so the histogram only needs a different offset.
+ * 
+ * @param numbers A pointer to the array of integers. Its contents are overwritten.
+ * @param count The number of integers in the array.
+ * @param filename The name of the file where the sorted integers will be written.
+ * @param parsed Optional statistics gathered while parsing the integers.
+ */
+void narrow_sort_and_write_numbers(int* numbers, int count, const string& filename,
+                                   const ParseResult* parsed = nullptr) {
+    int lo, hi;
+    RadixHistogram first_pass;
+    if (parsed != nullptr && parsed->histogram.threads > 0) {
+        lo = parsed->min_value;
+        hi = parsed->max_value;
+        first_pass = parsed->histogram;
+        first_pass.digit_offset = (int)((uint32_t)lo & (RADIX_BUCKETS - 1));
+    } else {
+        find_min_max(numbers, count, lo, hi);
+    }
+    uint32_t range = (uint32_t)hi - (uint32_t)lo;
+    int key_bits = 1;
+    while (key_bits < 32 && (range >> key_bits) != 0) {
+        key_bits++;
+    }
+    count_sort("narrow", count);
+
+    if (key_bits <= 8) {
+        cout << "Narrowed keys to " << key_bits << " bits (8-bit storage)" << endl;
+        narrow_sort_and_write<uint8_t>(numbers, count, lo, key_bits, filename, &first_pass);
+    } else if (key_bits <= 16) {
+        cout << "Narrowed keys to " << key_bits << " bits (16-bit storage)" << endl;
+        narrow_sort_and_write<uint16_t>(numbers, count, lo, key_bits, filename, &first_pass);
+    } else {
+        cout << "Narrowed keys to " << key_bits << " bits (32-bit storage)" << endl;
+        narrow_sort_and_write<uint32_t>(numbers, count, lo, key_bits, filename, &first_pass);
+    }
+}
+
+/**
+ * @brief Writes the distinct integers of an array in ascending order using a dense bitmap.
+ * 
+ * One bit per value in [lo, hi] is set, either with atomic ORs on a shared bitmap or, when the
+ * bitmap is small enough for every thread to own a copy in L2, in per-thread bitmaps that are ORed
+ * together afterwards. The set bits are then emitted in order.
+ * 
+ * @param numbers A pointer to the array of integers.
+ * @param n The number of integers in the array.
+ * @param lo The smallest integer of the array.
+ * @param hi The largest integer of the array.
+ * @param writer The destination of the distinct integers.
+ * @return size_t The number of distinct integers written.
+ */
+size_t dense_bitmap_write(const int* numbers, size_t n, int lo, int hi, BufferedCsvWriter& writer) {
+    size_t range = (size_t)((uint32_t)hi - (uint32_t)lo) + 1;
+    size_t words = (range + 63) / 64;
+    vector<uint64_t> bitmap(words, 0);
+    int max_threads = n < RADIX_PARALLEL_MIN ? 1 : omp_get_max_threads();
+
+    if (max_threads > 1 && words * sizeof(uint64_t) <= topology.l2_bytes / 2) {
+        // Small domain: every thread fills a private bitmap, then the bitmaps are ORed word by word
+        vector<vector<uint64_t>> locals(max_threads);
+        #pragma omp parallel num_threads(max_threads)
+        {
+            int t = omp_get_thread_num();
+            locals[t].assign(words, 0);
+            uint64_t* local = locals[t].data();
+            #pragma omp for schedule(static)
+            for (size_t i = 0; i < n; i++) {
+                uint32_t offset = (uint32_t)numbers[i] - (uint32_t)lo;
+                local[offset / 64] |= (uint64_t)1 << (offset % 64);
+            }
+            #pragma omp for schedule(static)
+            for (size_t w = 0; w < words; w++) {
+                uint64_t word = 0;
+                for (int u = 0; u < max_threads; u++) {
+                    if (!locals[u].empty()) {
+                        word |= locals[u][w];
+                    }
+                }
+                bitmap[w] = word;
+            }
+        }
+    } else {
+        uint64_t* shared = bitmap.data();
+        #pragma omp parallel for schedule(static) num_threads(max_threads)
+        for (size_t i = 0; i < n; i++) {
+            uint32_t offset = (uint32_t)numbers[i] - (uint32_t)lo;
+            uint64_t bit = (uint64_t)1 << (offset % 64);
+            if ((__atomic_load_n(&shared[offset / 64], __ATOMIC_RELAXED) & bit) == 0) {
+                __atomic_fetch_or(&shared[offset / 64], bit, __ATOMIC_RELAXED);  // Skip the atomic when already set
+            }
+        }
+    }
+
+    size_t distinct = 0;
+    for (size_t w = 0; w < words; w++) {
+        uint64_t word = bitmap[w];
+        while (word != 0) {
+            int bit = __builtin_ctzll(word);
+            writer.put((int)((uint32_t)lo + (uint32_t)(w * 64 + bit)));
+            word &= word - 1;
+            distinct++;
+        }
+    }
+    return distinct;
+}
+
+/**
+ * @brief A roaring-style compressed set of 32-bit keys.
+ * 
+ * Keys are grouped by their upper 16 bits into containers. A container stores its lower 16 bits as a
+ * sorted array while it holds at most ROARING_ARRAY_MAX values and as a 65536-bit bitmap beyond that,
+ * so sparse domains cost a few bytes per value and dense ones one bit per possible value.
+ */
+class RoaringSet {
+public:
+    /**
+     * @brief Adds a key to the set. Array containers are only sorted when the set is finalised.
+     * 
+     * @param key The key to add.
+     */
+    void add(uint32_t key) {
+        Container& container = containers[(uint16_t)(key >> 16)];
+        uint16_t low = (uint16_t)(key & 0xFFFF);
+        if (container.bits.empty()) {
+            container.values.push_back(low);
+            if (container.values.size() > ROARING_ARRAY_MAX) {
+                compact(container);
+            }
+        } else {
+            container.bits[low / 64] |= (uint64_t)1 << (low % 64);
+        }
+    }
+
+    /**
+     * @brief Adds every key of another set to this one.
+     * 
+     * @param other The set to merge in.
+     */
+    void merge(RoaringSet& other) {
+        for (auto& entry : other.containers) {
+            Container& source = entry.second;
+            Container& target = containers[entry.first];
+            if (!source.bits.empty()) {
+                to_bitmap(target);
+                for (size_t w = 0; w < source.bits.size(); w++) {
+                    target.bits[w] |= source.bits[w];
+                }
+            } else if (target.bits.empty()) {
+                target.values.insert(target.values.end(), source.values.begin(), source.values.end());
+                if (target.values.size() > ROARING_ARRAY_MAX) {
+                    compact(target);
+                }
+            } else {
+                for (uint16_t low : source.values) {
+                    target.bits[low / 64] |= (uint64_t)1 << (low % 64);
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Sorts and deduplicates the array containers and converts each container to its smaller form.
+     */
+    void finalize() {
+        for (auto& entry : containers) {
+            compact(entry.second);
+        }
+    }
+
+    /**
+     * @brief Calls a function for every key in ascending order. The set must be finalised.
+     * 
+     * @param visit Receives each key.
+     */
+    template <typename Visit>
+    void for_each(Visit visit) const {
+        for (const auto& entry : containers) {
+            uint32_t high = (uint32_t)entry.first << 16;
+            const Container& container = entry.second;
+            if (container.bits.empty()) {
+                for (uint16_t low : container.values) {
+                    visit(high | low);
+                }
+            } else {
+                for (size_t w = 0; w < container.bits.size(); w++) {
+                    uint64_t word = container.bits[w];
+                    while (word != 0) {
+                        visit(high | (uint32_t)(w * 64 + __builtin_ctzll(word)));
+                        word &= word - 1;
+                    }
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Describes the containers of a finalised set.
+     * 
+     * @param arrays Receives the number of array containers.
+     * @param bitmaps Receives the number of bitmap containers.
+     * @return size_t The bytes used by the container payloads.
+     */
+    size_t footprint(size_t& arrays, size_t& bitmaps) const {
+        size_t bytes = 0;
+        arrays = bitmaps = 0;
+        for (const auto& entry : containers) {
+            if (entry.second.bits.empty()) {
+                arrays++;
+                bytes += entry.second.values.size() * sizeof(uint16_t);
+            } else {
+                bitmaps++;
+                bytes += entry.second.bits.size() * sizeof(uint64_t);
+            }
+        }
+        return bytes;
+    }
+
+private:
+    /**
+     * @brief The lower 16 bits of the keys sharing one upper half: an array or a bitmap.
+     */
+    struct Container {
+        vector<uint16_t> values;  // Array form, used while 'bits' is empty
+        vector<uint64_t> bits;    // Bitmap form, 1024 words once converted
+    };
+
+    /**
+     * @brief Converts a container to bitmap form.
+     */
+    static void to_bitmap(Container& container) {
+        if (!container.bits.empty()) {
+            return;
+        }
+        container.bits.assign(65536 / 64, 0);
+        for (uint16_t low : container.values) {
+            container.bits[low / 64] |= (uint64_t)1 << (low % 64);
+        }
+        container.values.clear();
+        container.values.shrink_to_fit();
+    }
+
+    /**
+     * @brief Deduplicates an array container and picks the smaller of the two forms.
+     */
+    static void compact(Container& container) {
+        if (container.bits.empty()) {
+            sort(container.values.begin(), container.values.end());
+            container.values.erase(unique(container.values.begin(), container.values.end()), container.values.end());
+            if (container.values.size() > ROARING_ARRAY_MAX) {
+                to_bitmap(container);
+            }
+        }
+    }
+
+    map<uint16_t, Container> containers;
+};
+
+/**
+ * @brief Writes the distinct integers of an array in ascending order using a roaring-style set.
+ * 
+ * Every thread builds a private set from its chunk, the sets are merged, and the keys are emitted in
+ * order. The sign bit is flipped so that unsigned key order matches signed integer order.
+ * 
+ * @param numbers A pointer to the array of integers.
+ * @param n The number of integers in the array.
+ * @param writer The destination of the distinct integers.
+ * @return size_t The number of distinct integers written.
+ */
+size_t roaring_write(const int* numbers, size_t n, BufferedCsvWriter& writer) {
+    int max_threads = n < RADIX_PARALLEL_MIN ? 1 : omp_get_max_threads();
+    vector<RoaringSet> sets(max_threads);
+    #pragma omp parallel num_threads(max_threads)
+    {
+        RoaringSet& local = sets[omp_get_thread_num()];
+        #pragma omp for schedule(static)
+        for (size_t i = 0; i < n; i++) {
+            local.add((uint32_t)numbers[i] ^ 0x80000000u);
+        }
+    }
+    for (int t = 1; t < max_threads; t++) {
+        sets[0].merge(sets[t]);
+    }
+    sets[0].finalize();
+
+    size_t distinct = 0;
+    sets[0].for_each([&](uint32_t key) {
+        writer.put((int)(key ^ 0x80000000u));
+        distinct++;
+    });
+    size_t arrays, bitmaps;
+    size_t bytes = sets[0].footprint(arrays, bitmaps);
+    cout << "Roaring set: " << arrays << " array and " << bitmaps << " bitmap containers, " << bytes << " bytes" << endl;
+    return distinct;
+}
+
+/**
+ * @brief Writes the distinct integers of an array in ascending order using a bitmap instead of sorting.
+ * 
+ * With mode "dense" one bit per value between the minimum and maximum is used; with "roaring" a
+ * compressed roaring-style set. Mode "auto" picks the dense bitmap when the range has at most
+ * BITMAP_DENSE_MAX_RANGE values.
+ * 
+ * @param numbers A pointer to the array of integers.
+ * @param count The number of integers in the array.
+ * @param filename The name of the file where the distinct integers will be written.
+ * @param mode "auto", "dense" or "roaring".
+ * @param parsed Optional statistics gathered while parsing, used for the range.
+ */
+void bitmap_write_numbers(const int* numbers, int count, const string& filename, const string& mode,
+                          const ParseResult* parsed = nullptr) {
+    int lo, hi;
+    if (parsed != nullptr && parsed->count == count) {
+        lo = parsed->min_value;
+        hi = parsed->max_value;
+    } else {
+        find_min_max(numbers, count, lo, hi);
+    }
+    uint64_t range = (uint64_t)((uint32_t)hi - (uint32_t)lo) + 1;
+    bool dense = mode == "dense" || (mode == "auto" && range <= BITMAP_DENSE_MAX_RANGE);
+
+    BufferedCsvWriter writer(filename);
+    if (!writer.is_open()) {
+        cerr << "Error opening file " << filename << endl;  // Display an error if the file cannot be opened
+        return;
+    }
+    size_t distinct = dense ? dense_bitmap_write(numbers, count, lo, hi, writer) : roaring_write(numbers, count, writer);
+    writer.flush();
+    cout << (dense ? "Dense bitmap" : "Roaring bitmap") << ": " << distinct << " distinct values of " << count
+         << " numbers written to " << filename << endl;
+}
+
+/**
+ * @brief Sorts unsigned keys in place with an MSD (American flag) radix sort.
+ * 
+ * Each level counts the digit at 'shift', then permutes the keys into their buckets in place: every
+ * misplaced key is swapped into the next free slot of its bucket until a key belonging to the current
+ * slot comes back (cycle leader). Buckets are then sorted recursively on the next digit. Only the
+ * RADIX_BUCKETS counters of each level are needed besides the keys themselves.
+ * 
+ * @param keys A pointer to the keys to be sorted.
+ * @param n The number of keys.
+ * @param shift The bit position of the digit to sort on.
+ */
+void american_flag_sort(uint32_t* keys, size_t n, int shift) {
+    if (n <= AFLAG_INSERTION_MAX) {
+        for (size_t i = 1; i < n; i++) {
+            uint32_t key = keys[i];
+            size_t j = i;
+            while (j > 0 && keys[j - 1] > key) {
+                keys[j] = keys[j - 1];
+                j--;
+            }
+            keys[j] = key;
+        }
+        return;
+    }
+
+    size_t counts[RADIX_BUCKETS] = {0};
+    for (size_t i = 0; i < n; i++) {
+        counts[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+    }
+    while (shift > 0 && counts[(keys[0] >> shift) & (RADIX_BUCKETS - 1)] == n) {
+        // Every key shares this digit, so move straight on to the next one
+        shift = max(shift - RADIX_BITS, 0);
+        memset(counts, 0, sizeof(counts));
+        for (size_t i = 0; i < n; i++) {
+            counts[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+        }
+    }
+
+    size_t heads[RADIX_BUCKETS];
+    size_t tails[RADIX_BUCKETS];
+    size_t offset = 0;
+    for (int b = 0; b < RADIX_BUCKETS; b++) {
+        heads[b] = offset;
+        offset += counts[b];
+        tails[b] = offset;
+    }
+    for (int b = 0; b < RADIX_BUCKETS; b++) {
+        while (heads[b] < tails[b]) {
+            uint32_t key = keys[heads[b]];
+            int digit = (key >> shift) & (RADIX_BUCKETS - 1);
+            while (digit != b) {
+                swap(key, keys[heads[digit]++]);  // Place the key and pick up the one it displaces
+                digit = (key >> shift) & (RADIX_BUCKETS - 1);
+            }
+            keys[heads[b]++] = key;
+        }
+    }
+
+    if (shift == 0) {
+        return;
+    }
+    for (int b = 0; b < RADIX_BUCKETS; b++) {
+        size_t begin = tails[b] - counts[b];
+        if (counts[b] > 1) {
+            american_flag_sort(keys + begin, counts[b], max(shift - RADIX_BITS, 0));
+        }
+    }
+}
+
+/**
+ * @brief Sorts signed integers in place with the American flag radix engine.
+ * 
+ * Unlike the LSD radix engine this needs no second n-sized buffer. The first digit is placed just below
+ * the highest bit in which the smallest and largest key differ, since all keys share the bits above it.
+ * The top level is counted in parallel and permuted on one thread; its buckets are then sorted
+ * independently in parallel.
+ * 
+ * @param numbers A pointer to the array of integers to be sorted.
+ * @param n The number of integers in the array.
+ * @param parsed Optional statistics gathered while parsing, used for the key range.
+ */
+void american_flag_sort_numbers(int* numbers, size_t n, const ParseResult* parsed = nullptr) {
+    if (n < 2) {
+        return;
+    }
+    uint32_t* keys = (uint32_t*)numbers;
+    int lo, hi;
+    if (parsed != nullptr && parsed->count == (int)n) {
+        lo = parsed->min_value;
+        hi = parsed->max_value;
+    } else {
+        find_min_max(numbers, n, lo, hi);
+    }
+    #pragma omp parallel for if(n >= RADIX_PARALLEL_MIN)
+    for (size_t i = 0; i < n; i++) {
+        keys[i] ^= 0x80000000u;
+    }
+
+    uint32_t differing = ((uint32_t)lo ^ 0x80000000u) ^ ((uint32_t)hi ^ 0x80000000u);
+    int top_bit = 0;
+    while (top_bit < 31 && (differing >> (top_bit + 1)) != 0) {
+        top_bit++;
+    }
+    int shift = max(top_bit + 1 - RADIX_BITS, 0);
+
+    if (n < RADIX_PARALLEL_MIN || differing == 0) {
+        american_flag_sort(keys, n, shift);
+    } else {
+        // Count the top digit in parallel and permute it on one thread
+        size_t counts[RADIX_BUCKETS] = {0};
+        #pragma omp parallel
+        {
+            size_t local[RADIX_BUCKETS] = {0};
+            #pragma omp for schedule(static)
+            for (size_t i = 0; i < n; i++) {
+                local[(keys[i] >> shift) & (RADIX_BUCKETS - 1)]++;
+            }
+            #pragma omp critical
+            for (int b = 0; b < RADIX_BUCKETS; b++) {
+                counts[b] += local[b];
+            }
+        }
+        size_t heads[RADIX_BUCKETS];
+        size_t starts[RADIX_BUCKETS + 1];
+        starts[0] = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            heads[b] = starts[b];
+            starts[b + 1] = starts[b] + counts[b];
+        }
+        for (int b = 0; b < RADIX_BUCKETS; b++) {
+            while (heads[b] < starts[b + 1]) {
+                uint32_t key = keys[heads[b]];
+                int digit = (key >> shift) & (RADIX_BUCKETS - 1);
+                while (digit != b) {
+                    swap(key, keys[heads[digit]++]);
+                    digit = (key >> shift) & (RADIX_BUCKETS - 1);
+                }
+                keys[heads[b]++] = key;
+            }
+        }
+
+        // Sort the top-level buckets independently, largest share of work balanced dynamically
+        if (shift > 0) {
+            #pragma omp parallel for schedule(dynamic, 1)
+            for (int b = 0; b < RADIX_BUCKETS; b++) {
+                if (counts[b] > 1) {
+                    american_flag_sort(keys + starts[b], counts[b], max(shift - RADIX_BITS, 0));
+                }
+            }
+        }
+    }
+
+    #pragma omp parallel for if(n >= RADIX_PARALLEL_MIN)
+    for (size_t i = 0; i < n; i++) {
+        keys[i] ^= 0x80000000u;
+    }
+}
+
+/**
+ * @brief Cheap statistics about an input, gathered to choose a sorting engine.
+ */
+struct InputProbe {
+    size_t n = 0;                 // Number of integers
+    int min_value = 0;            // Smallest integer
+    int max_value = 0;            // Largest integer
+    uint64_t range = 0;           // Number of distinct values between min_value and max_value
+    size_t distinct_estimate = 0; // Estimated number of distinct integers
+    size_t runs_estimate = 0;     // Estimated number of ascending runs
+};
+
+/**
+ * @brief The engine chosen for an input, the thread count to run it with, and why.
+ */
+struct SortPlan {
+    string engine = "quicksort";  // "quicksort", "radix", "aflag", "counting", "merge", "network" or "incremental"
+    int threads = 1;              // Number of threads given to the engine
+    bool narrow = false;          // Sort offsets from the minimum in the narrowest key width
+    string rationale;             // Human-readable reason for the choice
+};
+
+/**
+ * @brief Samples an input to estimate its range, cardinality and presortedness.
+ * 
+ * The range is exact when the integers were parsed with read_numbers_with_histogram and otherwise
+ * taken from the sample. Cardinality is estimated from a strided sample of PROBE_SAMPLES integers with
+ * the GEE estimator (values seen once scale with sqrt(n / samples)). Runs are estimated by counting
+ * descents inside PROBE_BLOCKS short blocks of consecutive integers spread over the array.
+ * 
+ * @param numbers A pointer to the array of integers.
+ * @param n The number of integers in the array. Must be at least 1.
+ * @param parsed Optional statistics gathered while parsing the integers.
+ * @return InputProbe The estimated statistics.
+ */
+InputProbe probe_input(const int* numbers, size_t n, const ParseResult* parsed) {
+    InputProbe probe;
+    probe.n = n;
+
+    size_t samples = min(n, (size_t)PROBE_SAMPLES);
+    vector<int> sample(samples);
+    for (size_t i = 0; i < samples; i++) {
+        sample[i] = numbers[i * n / samples];
+    }
+    sort(sample.begin(), sample.end());
+
+    if (parsed != nullptr && parsed->count == (int)n) {
+        probe.min_value = parsed->min_value;
+        probe.max_value = parsed->max_value;
+    } else {
+        probe.min_value = sample.front();
+        probe.max_value = sample.back();
+    }
+    probe.range = (uint64_t)((uint32_t)probe.max_value - (uint32_t)probe.min_value) + 1;
+
+    size_t distinct = 0;
+    size_t singletons = 0;
+    for (size_t i = 0; i < samples; ) {
+        size_t j = i;
+        while (j < samples && sample[j] == sample[i]) {
+            j++;
+        }
+        distinct++;
+        singletons += (j - i == 1);
+        i = j;
+    }
+    double scale = sqrt((double)n / (double)samples);
+    probe.distinct_estimate = min(n, (size_t)(scale * singletons) + (distinct - singletons));
+
+    size_t block = min(n, (size_t)PROBE_BLOCK_LENGTH);
+    size_t blocks = min((size_t)PROBE_BLOCKS, n / block);
+    size_t descents = 0;
+    for (size_t b = 0; b < blocks; b++) {
+        const int* start = numbers + (n - block) * b / max(blocks - 1, (size_t)1);
+        for (size_t i = 1; i < block; i++) {
+            descents += (start[i] < start[i - 1]);
+        }
+    }
+    double descent_rate = blocks * (block - 1) == 0 ? 0.0 : (double)descents / (double)(blocks * (block - 1));
+    probe.runs_estimate = 1 + (size_t)(descent_rate * (double)(n - 1));
+    return probe;
+}
+
+/**
+ * @brief Chooses a sorting engine and thread count for an input.
+ * 
+ * An engine given with --engine is used as is. Otherwise tiny inputs go to the sorting network, small
+ * value ranges and few distinct values to counting sort, nearly sorted inputs to the run merge, large
+ * inputs to radix (narrowed when the range fits in 16 bits) and the rest to quicksort. Thread counts
+ * grow with the input, one thread per tuning.plan_elements_per_thread integers.
+ * 
+ * @param numbers A pointer to the array of integers.
+ * @param n The number of integers in the array. Must be at least 1.
+ * @param parsed Optional statistics gathered while parsing the integers.
+ * @return SortPlan The chosen engine and the reasoning behind it.
+ */
+SortPlan plan_sort(const int* numbers, size_t n, const ParseResult* parsed) {
+    SortPlan plan;
+    int max_threads = omp_get_max_threads();
+    plan.threads = (int)min((size_t)max_threads, max((size_t)1, n / tuning.plan_elements_per_thread));
+    plan.narrow = options.narrow;
+    if (options.engine != "auto") {
+        plan.engine = options.engine;
+        plan.threads = max_threads;
+        plan.rationale = "selected with --engine";
+        if (plan.engine == "network" && n > NETWORK_MAX) {
+            plan.engine = "quicksort";
+            plan.rationale = "the sorting network only takes up to " + to_string(NETWORK_MAX) + " integers";
+        } else if (plan.engine == "counting") {
+            int lo, hi;
+            if (parsed != nullptr && parsed->count == (int)n) {
+                lo = parsed->min_value;
+                hi = parsed->max_value;
+            } else {
+                find_min_max(numbers, n, lo, hi);
+            }
+            if ((uint64_t)((uint32_t)hi - (uint32_t)lo) + 1 > COUNTING_MAX_RANGE) {
+                plan.engine = "radix";
+                plan.rationale = "the value range is too wide for counting sort";
+            }
+        }
+        return plan;
+    }
+
+    if (options.early_emit) {
+        plan.engine = "quicksort";
+        plan.rationale = "--early-emit streams the finished prefix of the quicksort";
+        return plan;
+    }
+
+    InputProbe probe = probe_input(numbers, n, parsed);
+    string stats = "n=" + to_string(probe.n) + ", range=" + to_string(probe.range) +
+                   ", ~" + to_string(probe.distinct_estimate) + " distinct, ~" + to_string(probe.runs_estimate) + " runs";
+    if (n <= NETWORK_MAX) {
+        plan.engine = "network";
+        plan.threads = 1;
+        plan.rationale = "tiny input fits one sorting network";
+    } else if (probe.range <= COUNTING_MAX_RANGE && (probe.range <= n || probe.distinct_estimate * FEW_UNIQUE_RATIO <= n)) {
+        plan.engine = "counting";
+        plan.rationale = probe.range <= n ? "value range no larger than the input" : "few distinct values in a small range";
+    } else if (probe.runs_estimate * PRESORTED_RUN_LENGTH <= n) {
+        plan.engine = "merge";
+        plan.threads = 1;
+        plan.rationale = "input is nearly sorted, merging its natural runs";
+    } else if (n >= RADIX_MIN_N) {
+        plan.engine = "radix";
+        plan.narrow = plan.narrow || probe.range <= (1u << 16);
+        if (parsed != nullptr && parsed->histogram.threads > 0) {
+            plan.threads = parsed->histogram.threads;  // Keep the chunks whose histograms were gathered while parsing
+        }
+        plan.rationale = plan.narrow ? "large input, range fits in 16-bit keys" : "large input with wide random keys";
+    } else {
+        plan.engine = "quicksort";
+        plan.rationale = "small input with a wide value range";
+    }
+    plan.rationale += " (" + stats + ")";
+    return plan;
+}
+
+/**
+ * @brief Sorts an array of integers with the engine chosen by the planner.
+ * 
+ * Counting sort is only run once the exact range is known to fit COUNTING_MAX_RANGE; a plan made from a
+ * sampled range falls back to radix sort when an unsampled outlier widens it, and the plan is updated so
+ * that whatever reports it afterwards names the engine that ran.
+ * 
+ * @param numbers A pointer to the array of integers to be sorted.
+ * @param count The number of integers in the array.
+ * @param plan The engine and thread count to use; receives the engine actually used.
+ * @param parsed Optional statistics gathered while parsing the integers.
+ */
+void sort_numbers(int* numbers, int count, SortPlan& plan, const ParseResult* parsed = nullptr) {
+    int previous_threads = omp_get_max_threads();
+    omp_set_num_threads(plan.threads);
+    bool parse_stats = parsed != nullptr && parsed->count == count;
+    string& engine = plan.engine;
+
+    int lo = 0, hi = 0;
+    if (engine == "counting") {
+        if (parse_stats) {
+            lo = parsed->min_value;
+            hi = parsed->max_value;
+        } else {
+            find_min_max(numbers, count, lo, hi);
+        }
+        // The planner may have judged the range from a sample; an outlier it missed must not size the tables
+        if ((uint64_t)((uint32_t)hi - (uint32_t)lo) + 1 > COUNTING_MAX_RANGE) {
+            engine = "radix";
+            plan.rationale += "; the exact value range is too wide for counting sort, sorted with radix";
+        }
+    }
+
+    if (engine == "radix") {
+        radix_sort_numbers(numbers, count, parse_stats ? &parsed->histogram : nullptr);
+    } else if (engine == "aflag") {
+        american_flag_sort_numbers(numbers, count, parse_stats ? parsed : nullptr);
+    } else if (engine == "counting") {
+        counting_sort_numbers(numbers, count, lo, hi);
+    } else if (engine == "merge") {
+        merge_natural_runs(numbers, count);
+    } else if (engine == "network") {
+        network_sort_numbers(numbers, count);
+    } else {
+        // Sort numbers from array in parallel
+        uint64_t busy_before = total_busy_ns();
+        uint64_t wall_start = metrics_now_ns();
+        #pragma omp parallel
+        {
+            #pragma omp single
+            {
+                uint64_t start = metrics_now_ns();
+                quickSort(numbers, 0, count - 1);
+                count_task(start);
+            }
+        }
+        double wall = (double)(metrics_now_ns() - wall_start) * plan.threads;
+        last_thread_utilization = wall > 0 ? min(1.0, (total_busy_ns() - busy_before) / wall) : 0;
+    }
+    count_sort(engine, count);
+
+    omp_set_num_threads(previous_threads);
+}
+
+/**
+ * @brief Returns the largest resident set size the process has reached so far.
+ * 
+ * @return size_t The peak resident memory in bytes.
+ */
+size_t peak_rss_bytes() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (size_t)usage.ru_maxrss << 10;  // Linux reports kilobytes
+}
+
+/**
+ * @brief How the input is kept within --memory-limit, and the external sort's shape when it is not in memory.
+ */
+struct MemoryPlan {
+    string strategy = "in-memory";  // "in-memory", "narrowed" or "external"
+    size_t available = 0;           // Bytes of the budget left above what the process already holds
+    size_t run_size = 0;            // Integers sorted in memory per external run
+    int fan_in = 0;                 // Runs merged at once by the external sort
+    int passes = 0;                 // Merge passes of the external sort
+    string rationale;               // Human-readable reason for the choice
+};
+
+/**
+ * @brief Chooses how to sort n integers stored in a CSV file of the given size within a memory budget.
+ * 
+ * The budget left is the limit minus the resident size before the input was allocated. The input stays
+ * fully in memory when both the parallel parse (file text plus the array) and a radix sort (array plus
+ * buffer) fit.
+ * Otherwise, if the array alone fits, it is read with the streaming parser and sorted with narrowed
+ * keys or in place (see fit_plan_to_budget). Otherwise it is sorted externally: runs as large as
+ * half the budget allows (the array and the radix buffer), merged RUN_BUFFER_SIZE-buffered runs at a
+ * time in as many passes as needed.
+ * 
+ * @param n The number of integers.
+ * @param text_bytes The size of the CSV file holding them.
+ * @param limit The memory budget in bytes, or 0 for no budget.
+ * @param baseline The bytes the process held before allocating the input.
+ * @return MemoryPlan The chosen strategy.
+ */
+MemoryPlan plan_memory(size_t n, size_t text_bytes, size_t limit, size_t baseline) {
+    MemoryPlan memory;
+    if (limit == 0) {
+        memory.rationale = "no memory limit";
+        return memory;
+    }
+    memory.available = limit > baseline ? limit - baseline : 0;
+    // One reader buffer, and one writer buffer or the blocks of an asynchronous writer
+    size_t streams = RUN_BUFFER_SIZE + (options.async_io ? ASYNC_WRITE_BLOCKS : 1) * tuning.write_buffer_bytes;
+    if (max(text_bytes + 4 * n, 8 * n) + streams <= memory.available) {
+        memory.rationale = "the parsed text and the radix buffer fit";
+        return memory;
+    }
+    if (4 * n + streams <= memory.available) {
+        memory.strategy = "narrowed";
+        memory.rationale = "the array fits, but not with the text or a full-width radix buffer";
+        return memory;
+    }
+
+    memory.strategy = "external";
+    size_t room = memory.available > streams ? memory.available - streams : 0;
+    memory.run_size = max((size_t)RADIX_MIN_N, room / 8);
+    size_t runs = max((size_t)1, (n + memory.run_size - 1) / memory.run_size);
+    memory.fan_in = (int)min(runs, max((size_t)2, room / RUN_BUFFER_SIZE));
+    for (size_t remaining = runs; remaining > 1; remaining = (remaining + memory.fan_in - 1) / memory.fan_in) {
+        memory.passes++;
+    }
+    memory.rationale = to_string(runs) + " runs of " + to_string(memory.run_size) + " integers, fan-in " +
+                       to_string(memory.fan_in) + ", " + to_string(memory.passes) + " merge passes";
+    return memory;
+}
+
+/**
+ * @brief Adjusts a sort plan so that its scratch memory fits in the budget of a "narrowed" memory plan.
+ * 
+ * Engines that need a second array (radix and the run merge) are replaced: by a radix sort of keys
+ * narrowed to the value range when the narrowed buffer fits, or else by the in-place American flag sort.
+ * 
+ * @param plan The sort plan to adjust.
+ * @param numbers A pointer to the array of integers.
+ * @param n The number of integers in the array.
+ * @param available The bytes of memory left in the budget.
+ */
+void fit_plan_to_budget(SortPlan& plan, const int* numbers, size_t n, size_t available) {
+    if (!plan.narrow && plan.engine != "radix" && plan.engine != "merge") {
+        return;  // The other engines sort in place or need only a small table
+    }
+    int lo, hi;
+    find_min_max(numbers, n, lo, hi);
+    uint32_t range = (uint32_t)hi - (uint32_t)lo;
+    size_t key_bytes = range <= 0xFF ? 1 : range <= 0xFFFF ? 2 : 4;
+    if (4 * n + key_bytes * n + RUN_BUFFER_SIZE + tuning.write_buffer_bytes <= available) {
+        plan.engine = "radix";
+        plan.narrow = true;
+        plan.rationale = "narrowed " + to_string(8 * key_bytes) + "-bit keys fit the memory budget";
+    } else {
+        plan.engine = "aflag";
+        plan.narrow = false;
+        plan.rationale = "only an in-place sort fits the memory budget";
+    }
+}
+
+/**
+ * @brief Writes each distinct integer of a sorted stream once, optionally with its count.
+ * 
+ * Acts as the merge destination of the external sort when --unique is given.
+ */
+class UniqueWriter {
+public:
+    /**
+     * @brief Wraps a CSV writer.
+     * 
+     * @param out The writer receiving the distinct integers.
+     * @param counts Whether to write "value:count" pairs.
+     */
+    UniqueWriter(BufferedCsvWriter& out, bool counts) : out(out), counts(counts) {}
+
+    /**
+     * @brief Accepts the next integer of the sorted stream.
+     * 
+     * @param value The integer to write.
+     */
+    void put(int value) {
+        if (occurrences > 0 && value == last) {
+            occurrences++;
+            return;
+        }
+        finish();
+        last = value;
+        occurrences = 1;
+    }
+
+    /**
+     * @brief Writes the pending value. Called once the stream ends.
+     */
+    void finish() {
+        if (occurrences > 0) {
+            if (counts) {
+                out.put_count(last, occurrences);
+            } else {
+                out.put(last);
+            }
+        }
+        occurrences = 0;
+    }
+
+private:
+    BufferedCsvWriter& out;
+    bool counts;
+    int last = 0;
+    long long occurrences = 0;
+};
+
+/**
+ * @brief Merges sorted CSV run files into one file and deletes the runs.
+ * 
+ * @param files The names of the run files.
+ * @param output The name of the merged file.
+ * @param distinct Whether to apply --unique while writing, used by the last pass.
+ * @param reactor An optional reactor that writes the output asynchronously.
+ * @return bool False if a file could not be opened or read.
+ */
+bool merge_run_files(const vector<string>& files, const string& output, bool distinct, IoReactor* reactor) {
+    vector<CsvRunReader*> runs;
+    bool opened = true;
+    for (const string& file : files) {
+        runs.push_back(new CsvRunReader(file));
+        opened = opened && runs.back()->is_open();
+    }
+    BufferedCsvWriter writer(output, reactor);
+    opened = opened && writer.is_open();
+    if (!opened) {
+        cerr << "Error opening the runs merged into " << output << endl;
+    } else if (runs.empty()) {
+        // Nothing to merge; the output stays empty
+    } else if (distinct) {
+        UniqueWriter unique_writer(writer, options.unique_counts);
+        merge_runs(runs, unique_writer);
+        unique_writer.finish();
+    } else {
+        merge_runs(runs, writer);
+    }
+    for (size_t i = 0; i < runs.size(); i++) {
+        opened = opened && !runs[i]->failed();
+        delete runs[i];
+        remove(files[i].c_str());
+    }
+    return opened;
+}
+
+/**
+ * @brief Sorts a CSV file that does not fit in memory.
+ * 
+ * The input is streamed in runs of memory.run_size integers. Each run is sorted with the planner's
+ * engine and written to a temporary CSV file next to the output. The runs are then merged
+ * memory.fan_in at a time until one pass can produce the output. With --async every file is written
+ * through an IoReactor, so the text is formatted while earlier blocks are being written. On an error
+ * every temporary run and pass file is deleted before returning.
+ * 
+ * @param input The name of the CSV file to sort.
+ * @param output The name of the sorted CSV file to write.
+ * @param memory The run size and fan-in to use.
+ * @return int The number of integers sorted, or -1 if a file could not be opened or the input is invalid.
+ */
+int external_sort_file(const string& input, const string& output, const MemoryPlan& memory) {
+    CsvRunReader in(input);
+    if (!in.is_open()) {
+        cerr << "Error opening file " << input << endl;
+        return -1;
+    }
+    IoReactor reactor;
+    IoReactor* io = options.async_io ? &reactor : nullptr;
+    vector<string> files;
+    // Deletes the temporary files written so far, along with those of an unfinished pass, and fails
+    auto abandon = [&](const vector<string>& pending) {
+        for (const string& file : files) {
+            unlink(file.c_str());
+        }
+        for (const string& file : pending) {
+            unlink(file.c_str());  // Unlike remove, never takes a directory that blocked the pass
+        }
+        return -1;
+    };
+    vector<int> chunk(memory.run_size);
+    int total = 0;
+    struct stat info;
+    uint64_t input_bytes = stat(input.c_str(), &info) == 0 ? (uint64_t)info.st_size : 0;
+    enter_parsing_phase("external sort: forming runs", input_bytes);
+    for (bool more = true; more; ) {
+        size_t m = 0;
+        while (m < chunk.size() && (more = in.next(chunk[m]))) {
+            m++;
+        }
+        if (m == 0) {
+            break;
+        }
+        SortPlan plan = plan_sort(chunk.data(), m, nullptr);
+        plan.narrow = false;  // Runs are written in full width
+        sort_numbers(chunk.data(), (int)m, plan);
+        files.push_back(output + ".run" + to_string(files.size()));
+        BufferedCsvWriter writer(files.back(), io);
+        if (!writer.is_open()) {
+            cerr << "Error opening file " << files.back() << endl;
+            return abandon({});
+        }
+        for (size_t i = 0; i < m; i++) {
+            writer.put(chunk[i]);
+        }
+        total += (int)m;
+    }
+    if (in.failed()) {
+        cerr << "Error: " << input << " holds a number that is missing its digits or does not fit in 32 bits" << endl;
+        return abandon({});
+    }
+    vector<int>().swap(chunk);  // Return the run memory before the merge buffers are allocated
+
+    for (int pass = 0; files.size() > (size_t)max(memory.fan_in, 1); pass++) {
+        enter_parsing_phase("external sort: intermediate merge pass", input_bytes);
+        vector<string> merged;
+        for (size_t g = 0; g < files.size(); g += memory.fan_in) {
+            vector<string> group(files.begin() + g, files.begin() + min(files.size(), g + memory.fan_in));
+            merged.push_back(output + ".pass" + to_string(pass) + "." + to_string(merged.size()));
+            if (!merge_run_files(group, merged.back(), false, io)) {
+                return abandon(merged);
+            }
+        }
+        files.swap(merged);
+    }
+    enter_parsing_phase("external sort: final merge", input_bytes);
+    if (!merge_run_files(files, output, options.unique, io)) {
+        return abandon({});
+    }
+    cout << "Numbers written to " << output << endl;
+    return total;
+}
+
+/**
+ * @brief Generates random integers straight into a CSV file, chunk by chunk.
+ * 
+ * Used instead of generate_random_numbers and write_numbers_to_file when the array would not fit
+ * in the memory budget.
+ * 
+ * @param n The number of random integers to generate.
+ * @param filename The name of the file where the integers will be written.
+ */
+void generate_numbers_to_file(int n, const string& filename) {
+    BufferedCsvWriter writer(filename);
+    if (!writer.is_open()) {
+        cerr << "Error opening file " << filename << endl;
+        return;
+    }
+    vector<int> chunk(RUN_BUFFER_SIZE / sizeof(int));
+    for (int done = 0; done < n; ) {
+        int m = min(n - done, (int)chunk.size());
+        generate_random_numbers(chunk.data(), m);
+        for (int i = 0; i < m; i++) {
+            writer.put(chunk[i]);
+        }
+        done += m;
+        phase_progress.done.store((uint64_t)done, memory_order_relaxed);
+    }
+    cout << "Numbers written to " << filename << endl;
+}
+
+/**
+ * @brief Sorts with quicksort while a writer thread streams out the finished prefix of the array.
+ * 
+ * Used by --early-emit. The leftmost partitions finish long before the whole sort, so the writer
+ * formats and writes everything below the SortedFrontier as it advances, overlapping the output with
+ * the rest of the sort and cutting the time to the first byte written.
+ * 
+ * @param numbers A pointer to the array of integers to be sorted.
+ * @param count The number of integers in the array.
+ * @param plan The thread count to sort with.
+ * @param filename The name of the file where the sorted integers will be written.
+ */
+void sort_and_stream_numbers(int* numbers, int count, const SortPlan& plan, const string& filename) {
+    BufferedCsvWriter out(filename);
+    if (!out.is_open()) {
+        cerr << "Error opening file " << filename << endl;
+        return;
+    }
+    SortedFrontier frontier(count);
+    auto start = high_resolution_clock::now();
+    double first_write = -1;
+
+    thread writer([&] {
+        UniqueWriter unique_writer(out, options.unique_counts);
+        for (int written = 0; written < count; ) {
+            int ready = frontier.wait_beyond(written);
+            for (int i = written; i < ready; i++) {
+                if (options.unique) {
+                    unique_writer.put(numbers[i]);
+                } else {
+                    out.put(numbers[i]);
+                }
+            }
+            if (first_write < 0) {
+                out.flush();
+                first_write = duration<double>(high_resolution_clock::now() - start).count();
+            }
+            written = ready;
+        }
+        unique_writer.finish();
+        out.flush();
+    });
+
+    int previous_threads = omp_get_max_threads();
+    omp_set_num_threads(plan.threads);
+    #pragma omp parallel
+    {
+        #pragma omp single
+        {
+            uint64_t task_start = metrics_now_ns();
+            quicksort_reporting(numbers, 0, count - 1, frontier);
+            count_task(task_start);
+        }
+    }
+    omp_set_num_threads(previous_threads);
+    count_sort("quicksort", count);
+    double sorted = duration<double>(high_resolution_clock::now() - start).count();
+    writer.join();
+    double done = duration<double>(high_resolution_clock::now() - start).count();
+
+    cout << "Numbers written to " << filename << endl;
+    cout << "Early emission: first bytes after " << first_write << " s, sort done after " << sorted
+         << " s, output done after " << done << " s" << endl;
+}
+
+/**
+ * @brief Writes only the k smallest integers of an array, sorting no more than needed.
+ * 
+ * Used by --head=k. With --unique the first k distinct values are written instead.
+ * 
+ * @param numbers A pointer to the array of integers.
+ * @param count The number of integers in the array.
+ * @param k The number of integers (or distinct values) to write.
+ * @param filename The name of the file where the integers will be written.
+ */
+void write_sorted_head(int* numbers, int count, long long k, const string& filename) {
+    BufferedCsvWriter out(filename);
+    if (!out.is_open()) {
+        cerr << "Error opening file " << filename << endl;
+        return;
+    }
+    IncrementalSorter sorter(numbers, count);
+    UniqueWriter unique_writer(out, options.unique_counts);
+    long long emitted = 0;
+    int value;
+    int last = 0;
+    while (sorter.next(value)) {
+        if (options.unique) {
+            bool fresh = emitted == 0 || value != last;
+            if (fresh && emitted == k) {
+                break;
+            }
+            emitted += fresh;
+            unique_writer.put(value);
+        } else {
+            if (emitted == k) {
+                break;
+            }
+            emitted++;
+            out.put(value);
+        }
+        last = value;
+    }
+    unique_writer.finish();
+    count_sort("incremental", (size_t)emitted);
+    cout << "Head: " << emitted << (options.unique ? " smallest distinct values of " : " smallest of ")
+         << count << " numbers written to " << filename << endl;
+}
+
+/**
+ * @brief Reads the first line of a small sysfs file.
+ * 
+ * @param path The path of the file.
+ * @return string The line read, or an empty string if the file does not exist.
+ */
+string read_sys_line(const string& path) {
+    ifstream infile(path);
+    string line;
+    if (infile.is_open()) {
+        getline(infile, line);
+    }
+    return line;
+}
+
+/**
+ * @brief Parses a sysfs size such as "48K" or "32M" into bytes.
+ * 
+ * @param text The size as written by the kernel.
+ * @return size_t The size in bytes, or 0 if the text is not a size.
+ */
+size_t parse_sys_size(const string& text) {
+    size_t value = 0;
+    size_t i = 0;
+    while (i < text.size() && text[i] >= '0' && text[i] <= '9') {
+        value = value * 10 + (size_t)(text[i++] - '0');
+    }
+    if (i < text.size() && (text[i] == 'K' || text[i] == 'k')) {
+        value <<= 10;
+    } else if (i < text.size() && text[i] == 'M') {
+        value <<= 20;
+    } else if (i < text.size() && text[i] == 'G') {
+        value <<= 30;
+    }
+    return value;
+}
+
+/**
+ * @brief Counts the CPUs in a sysfs CPU list such as "0-3,8-11".
+ * 
+ * @param list The CPU list as written by the kernel.
+ * @return int The number of CPUs listed.
+ */
+int count_cpu_list(const string& list) {
+    int count = 0;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t comma = list.find(',', pos);
+        string range = list.substr(pos, comma == string::npos ? string::npos : comma - pos);
+        size_t dash = range.find('-');
+        try {
+            if (dash == string::npos) {
+                stoi(range);
+                count++;
+            } else {
+                count += stoi(range.substr(dash + 1)) - stoi(range.substr(0, dash)) + 1;
+            }
+        } catch (exception &err) {
+            // Ignore malformed entries
+        }
+        pos = comma == string::npos ? list.size() : comma + 1;
+    }
+    return count;
+}
+
+/**
+ * @brief Reads the cache sizes, core layout and NUMA nodes of the machine from sysfs.
+ * 
+ * Caches are taken from the first CPU. Sockets and physical cores are counted from the distinct
+ * (package, core) pairs of the online CPUs, and NUMA nodes from /sys/devices/system/node/node*.
+ * Anything that cannot be read keeps the defaults of CpuTopology.
+ */
+void detect_topology() {
+    const string cpu_root = "/sys/devices/system/cpu/";
+    for (int index = 0; ; index++) {
+        string dir = cpu_root + "cpu0/cache/index" + to_string(index) + "/";
+        string level = read_sys_line(dir + "level");
+        if (level.empty()) {
+            break;
+        }
+        string type = read_sys_line(dir + "type");
+        size_t size = parse_sys_size(read_sys_line(dir + "size"));
+        if (size == 0 || type == "Instruction") {
+            continue;
+        }
+        if (level == "1") {
+            topology.l1d_bytes = size;
+        } else if (level == "2") {
+            topology.l2_bytes = size;
+        } else if (level == "3") {
+            topology.l3_bytes = size;
+            topology.l3_shared_cpus = max(1, count_cpu_list(read_sys_line(dir + "shared_cpu_list")));
+        }
+    }
+
+    int logical = 0;
+    vector<pair<int, int>> cores;  // Distinct (package, core) pairs
+    vector<int> packages;
+    int possible = count_cpu_list(read_sys_line(cpu_root + "possible"));
+    for (int cpu = 0; cpu < max(possible, 1); cpu++) {
+        string dir = cpu_root + "cpu" + to_string(cpu) + "/";
+        if (read_sys_line(dir + "online") == "0") {
+            continue;
+        }
+        string package = read_sys_line(dir + "topology/physical_package_id");
+        string core = read_sys_line(dir + "topology/core_id");
+        if (package.empty() || core.empty()) {
+            continue;
+        }
+        logical++;
+        pair<int, int> id(stoi(package), stoi(core));
+        if (find(cores.begin(), cores.end(), id) == cores.end()) {
+            cores.push_back(id);
+        }
+        if (find(packages.begin(), packages.end(), id.first) == packages.end()) {
+            packages.push_back(id.first);
+        }
+    }
+    if (logical > 0) {
+        topology.logical_cpus = logical;
+        topology.sockets = (int)packages.size();
+        topology.cores_per_socket = (int)cores.size() / topology.sockets;
+        topology.smt_per_core = max(1, logical / (int)cores.size());
+    }
+
+    int nodes = 0;
+    while (!read_sys_line("/sys/devices/system/node/node" + to_string(nodes) + "/cpulist").empty()) {
+        nodes++;
+    }
+    topology.numa_nodes = max(1, nodes);
+}
+
+/**
+ * @brief Derives the default block sizes of the sort, parse and format kernels from the detected topology.
+ * 
+ * Parser chunks and planner work units are sized to one L2 cache, the CSV formatting buffer to half of
+ * it so the text is written out while still cached, and quicksort stops creating tasks for sub-arrays
+ * that fit in an eighth of L1. The radix digit stays at RADIX_BITS: whether the 128 KiB of write-combining
+ * staging lines of 11-bit digits pay off is not visible in cache sizes, so "tune" measures it. A tuning
+ * profile, when present, overrides these values.
+ */
+void apply_topology_defaults() {
+    tuning = TuningProfile();
+    tuning.parse_chunk_bytes = max(topology.l2_bytes, (size_t)1 << 16);
+    tuning.write_buffer_bytes = max(topology.l2_bytes / 2, (size_t)1 << 16);
+    tuning.plan_elements_per_thread = max(topology.l2_bytes / sizeof(int), (size_t)1 << 12);
+    tuning.quicksort_cutoff = (int)max(topology.l1d_bytes / sizeof(int) / 8, (size_t)100);
+}
+
+/**
+ * @brief Prints the detected topology and the defaults derived from it.
+ * 
+ * Implements the "topology" subcommand: ./quicksort_final topology
+ * 
+ * @return int Returns 0.
+ */
+int topology_command() {
+    cout << "L1d cache: " << topology.l1d_bytes / 1024 << " KiB" << endl;
+    cout << "L2 cache: " << topology.l2_bytes / 1024 << " KiB" << endl;
+    cout << "L3 cache: " << topology.l3_bytes / 1024 << " KiB shared by " << topology.l3_shared_cpus << " CPUs" << endl;
+    cout << "Sockets: " << topology.sockets << ", cores per socket: " << topology.cores_per_socket
+         << ", threads per core: " << topology.smt_per_core << ", logical CPUs: " << topology.logical_cpus << endl;
+    cout << "NUMA nodes: " << topology.numa_nodes << endl;
+    cout << "Derived defaults: parse_chunk_bytes=" << tuning.parse_chunk_bytes
+         << " write_buffer_bytes=" << tuning.write_buffer_bytes
+         << " plan_elements_per_thread=" << tuning.plan_elements_per_thread
+         << " quicksort_cutoff=" << tuning.quicksort_cutoff
+         << " radix_bits=" << tuning.radix_bits << endl;
+    return 0;
+}
+
+/**
+ * @brief Measures the machine's sustainable memory bandwidth with STREAM-like copy and triad kernels.
+ * 
+ * Three arrays of four times the L3 cache, clamped to BANDWIDTH_PROBE_MIN..BANDWIDTH_PROBE_MAX bytes, are
+ * initialised in parallel so their pages are spread like the sort's data, then copy (c = a) and triad
+ * (a = b + s * c) are each run BANDWIDTH_PROBE_REPS times on all threads. Bytes are counted as STREAM
+ * does: 16 per element for copy and 24 for triad.
+ * 
+ * @return double The best bandwidth observed, in GB/s.
+ */
+double measure_peak_bandwidth() {
+    size_t bytes = min(max(4 * topology.l3_bytes, (size_t)BANDWIDTH_PROBE_MIN), (size_t)BANDWIDTH_PROBE_MAX);
+    size_t count = bytes / sizeof(double);
+    double* a = new double[count];
+    double* b = new double[count];
+    double* c = new double[count];
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; i++) {
+        a[i] = 1.0;
+        b[i] = 2.0;
+        c[i] = 0.0;
+    }
+
+    double best = 0.0;
+    for (int rep = 0; rep < BANDWIDTH_PROBE_REPS; rep++) {
+        auto start = high_resolution_clock::now();
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < count; i++) {
+            c[i] = a[i];
+        }
+        duration<double> copy_time = high_resolution_clock::now() - start;
+        best = max(best, 16.0 * count / copy_time.count() / 1e9);
+
+        start = high_resolution_clock::now();
+        #pragma omp parallel for schedule(static)
+        for (size_t i = 0; i < count; i++) {
+            a[i] = b[i] + 3.0 * c[i];
+        }
+        duration<double> triad_time = high_resolution_clock::now() - start;
+        best = max(best, 24.0 * count / triad_time.count() / 1e9);
+    }
+
+    delete[] a;
+    delete[] b;
+    delete[] c;
+    return best;
+}
+
+char stats_path[4096];            // --stats-file, copied when the handler is installed
+char stats_temporary[4096 + 8];   // Where the dump is written before being renamed over stats_path
+uint64_t stats_start_ns = 0;      // metrics_now_ns() when the handler was installed
+
+/**
+ * @brief A fixed buffer that formats text without allocating, for use inside a signal handler.
+ */
+struct SignalText {
+    char data[16384];
+    size_t len = 0;
+
+    /**
+     * @brief Appends a NUL-terminated string, truncating at the end of the buffer.
+     * 
+     * @param text The string.
+     */
+    void put(const char* text) {
+        while (*text != '\0' && len < sizeof(data)) {
+            data[len++] = *text++;
+        }
+    }
+
+    /**
+     * @brief Appends an unsigned integer in decimal.
+     * 
+     * @param value The integer.
+     */
+    void put(uint64_t value) {
+        char digits[20];
+        int n = 0;
+        do {
+            digits[n++] = (char)('0' + value % 10);
+            value /= 10;
+        } while (value != 0);
+        while (n > 0 && len < sizeof(data)) {
+            data[len++] = digits[--n];
+        }
+    }
+
+    /**
+     * @brief Appends a duration in seconds with millisecond precision.
+     * 
+     * @param ns The duration in nanoseconds.
+     */
+    void put_seconds(uint64_t ns) {
+        uint64_t ms = ns / 1000000;
+        put(ms / 1000);
+        char fraction[5] = {'.', (char)('0' + ms / 100 % 10), (char)('0' + ms / 10 % 10), (char)('0' + ms % 10), '\0'};
+        put(fraction);
+    }
+
+    /**
+     * @brief Appends a rate per second of a count over a duration.
+     * 
+     * @param count The count.
+     * @param ns The duration in nanoseconds.
+     */
+    void put_rate(uint64_t count, uint64_t ns) {
+        put(ns > 0 ? (uint64_t)((unsigned __int128)count * 1000000000 / ns) : 0);
+        put("/s");
+    }
+};
+
+/**
+ * @brief Writes a snapshot of the program's state to --stats-file on SIGUSR1.
+ * 
+ * Only async-signal-safe calls are made (clock_gettime, open, read, write, close and rename), and the
+ * state comes from atomics only: the phase and its progress, the totals and per-thread slots of the
+ * metrics counters with the time since each thread last counted work (a finished task, a parsed or a
+ * written buffer), and the resident and peak memory from /proc/self/status.
+ * The dump is written to a temporary file and renamed over the old one, so readers never see it half
+ * written. Nothing in the sorting or parsing paths takes a lock for it.
+ * 
+ * @param signal The signal number.
+ */
+void stats_signal_handler(int signal) {
+    (void)signal;
+    static atomic_flag dumping = ATOMIC_FLAG_INIT;
+    if (dumping.test_and_set()) {
+        return;  // Another thread is already writing a dump
+    }
+    int saved_errno = errno;
+    static SignalText out;  // Static so the handler does not need 16 KiB of stack
+    out.len = 0;
+    uint64_t now = metrics_now_ns();
+    uint64_t phase_ns = now - phase_progress.started_ns.load(memory_order_relaxed);
+    uint64_t uptime_ns = now - stats_start_ns;
+
+    out.put("phase: ");
+    out.put(phase_progress.name.load(memory_order_acquire));
+    out.put("\nphase_seconds: ");
+    out.put_seconds(phase_ns);
+    const char* unit = phase_progress.unit.load(memory_order_relaxed);
+    if (*unit != '\0') {
+        out.put("\nprogress: ");
+        out.put(phase_progress.done.load(memory_order_relaxed));
+        uint64_t total = phase_progress.total.load(memory_order_relaxed);
+        if (total > 0) {
+            out.put(" of ");
+            out.put(total);
+        }
+        out.put(" ");
+        out.put(unit);
+    }
+    out.put("\nuptime_seconds: ");
+    out.put_seconds(uptime_ns);
+
+    uint64_t sorted = 0, parsed = 0, written = 0, tasks = 0;
+    int slots = min(metrics_slots_taken.load(memory_order_relaxed), METRICS_THREADS);
+    for (int s = 0; s < slots; s++) {
+        sorted += thread_counters[s].elements_sorted.load(memory_order_relaxed);
+        parsed += thread_counters[s].bytes_parsed.load(memory_order_relaxed);
+        written += thread_counters[s].bytes_written.load(memory_order_relaxed);
+        tasks += thread_counters[s].tasks.load(memory_order_relaxed);
+    }
+    out.put("\nelements_sorted: ");
+    out.put(sorted);
+    out.put(" (");
+    out.put_rate(sorted, uptime_ns);
+    out.put(")\nbytes_parsed: ");
+    out.put(parsed);
+    out.put(" (");
+    out.put_rate(parsed, uptime_ns);
+    out.put(")\nbytes_written: ");
+    out.put(written);
+    out.put(" (");
+    out.put_rate(written, uptime_ns);
+    out.put(")\nquicksort_tasks: ");
+    out.put(tasks);
+
+    // Copy the resident and peak memory lines from the kernel's status file
+    char status[4096];
+    int fd = open("/proc/self/status", O_RDONLY | O_CLOEXEC);
+    ssize_t got = fd >= 0 ? read(fd, status, sizeof(status) - 1) : -1;
+    if (fd >= 0) {
+        close(fd);
+    }
+    status[got > 0 ? got : 0] = '\0';
+    for (char* line = status; *line != '\0'; ) {
+        char* end = line;
+        while (*end != '\0' && *end != '\n') {
+            end++;
+        }
+        bool more = *end == '\n';
+        *end = '\0';
+        if (strncmp(line, "VmRSS:", 6) == 0 || strncmp(line, "VmHWM:", 6) == 0) {
+            out.put("\n");
+            out.put(line);
+        }
+        line = more ? end + 1 : end;
+    }
+    if (options.memory_limit > 0) {
+        out.put("\nmemory_limit: ");
+        out.put((uint64_t)(options.memory_limit >> 10));
+        out.put(" kB");
+    }
+
+    out.put("\nthreads:");
+    for (int s = 0; s < slots; s++) {
+        const ThreadCounters& counters = thread_counters[s];
+        uint64_t active = counters.last_active_ns.load(memory_order_relaxed);
+        out.put("\n  slot ");
+        out.put((uint64_t)s);
+        out.put(": tasks ");
+        out.put(counters.tasks.load(memory_order_relaxed));
+        out.put(", busy ");
+        out.put_seconds(counters.busy_ns.load(memory_order_relaxed));
+        out.put(" s, sorted ");
+        out.put(counters.elements_sorted.load(memory_order_relaxed));
+        out.put(", parsed ");
+        out.put(counters.bytes_parsed.load(memory_order_relaxed));
+        out.put(" B, written ");
+        out.put(counters.bytes_written.load(memory_order_relaxed));
+        out.put(" B, last work ");
+        if (active == 0) {
+            out.put("never");
+        } else {
+            out.put_seconds(now > active ? now - active : 0);
+            out.put(" s ago");
+        }
+    }
+    out.put("\n");
+
+    fd = open(stats_temporary, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+        for (size_t sent = 0; sent < out.len; ) {
+            ssize_t n = write(fd, out.data + sent, out.len - sent);
+            if (n <= 0) {
+                break;
+            }
+            sent += (size_t)n;
+        }
+        close(fd);
+        rename(stats_temporary, stats_path);
+    }
+    errno = saved_errno;
+    dumping.clear();
+}
+
+/**
+ * @brief Installs the SIGUSR1 handler that dumps the program's state to --stats-file.
+ */
+void install_stats_handler() {
+    snprintf(stats_path, sizeof(stats_path), "%s", options.stats_file.c_str());
+    snprintf(stats_temporary, sizeof(stats_temporary), "%s.tmp", stats_path);
+    stats_start_ns = metrics_now_ns();
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stats_signal_handler;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, nullptr);
+}
+
+/**
+ * @brief Durations of one phase, bucketed for the Prometheus histogram.
+ */
+struct PhaseHistogram {
+    uint64_t buckets[7] = {0};  // Phases no longer than each of PHASE_BUCKETS, then all of them
+    uint64_t count = 0;         // Phases recorded
+    double sum = 0;             // Total seconds recorded
+};
+
+const double PHASE_BUCKETS[] = {0.001, 0.01, 0.1, 1, 10, 100};  // Upper bounds of the phase histogram in seconds
+map<string, PhaseHistogram> phase_histograms;
+mutex phase_histograms_guard;
+const steady_clock::time_point process_start = steady_clock::now();
+atomic<bool> metrics_file_closed(false);  // Set once the exit snapshot of --metrics-file is written
+
+/**
+ * @brief Adds a phase duration to its histogram. Phases are coarse, so a lock is cheap here.
+ * 
+ * @param name The phase name.
+ * @param seconds The duration of the phase.
+ */
+void observe_phase(const string& name, double seconds) {
+    lock_guard<mutex> lock(phase_histograms_guard);
+    PhaseHistogram& histogram = phase_histograms[name];
+    for (int b = 0; b < 6; b++) {
+        histogram.buckets[b] += seconds <= PHASE_BUCKETS[b];
+    }
+    histogram.buckets[6]++;
+    histogram.count++;
+    histogram.sum += seconds;
+}
+
+/**
+ * @brief Formats the current metrics in the Prometheus text exposition format (version 0.0.4).
+ * 
+ * Counters are summed over the per-thread slots at the time of the call; each slot is read with relaxed
+ * loads, so a scrape never blocks the threads that count.
+ * 
+ * @return string The exposition text.
+ */
+string metrics_text() {
+    uint64_t sorted = 0, parsed = 0, written = 0, tasks = 0;
+    int slots = min(metrics_slots_taken.load(), METRICS_THREADS);
+    for (int s = 0; s < slots; s++) {
+        sorted += thread_counters[s].elements_sorted.load(memory_order_relaxed);
+        parsed += thread_counters[s].bytes_parsed.load(memory_order_relaxed);
+        written += thread_counters[s].bytes_written.load(memory_order_relaxed);
+        tasks += thread_counters[s].tasks.load(memory_order_relaxed);
+    }
+    ostringstream out;
+    auto family = [&](const char* name, const char* type, const char* help) {
+        out << "# HELP " << name << " " << help << "\n# TYPE " << name << " " << type << "\n";
+    };
+    family("quicksort_elements_sorted_total", "counter", "Integers sorted.");
+    out << "quicksort_elements_sorted_total " << sorted << "\n";
+    family("quicksort_bytes_parsed_total", "counter", "CSV bytes parsed.");
+    out << "quicksort_bytes_parsed_total " << parsed << "\n";
+    family("quicksort_bytes_written_total", "counter", "Output bytes written.");
+    out << "quicksort_bytes_written_total " << written << "\n";
+    family("quicksort_tasks_total", "counter", "Tasks run by the parallel quicksort variants.");
+    out << "quicksort_tasks_total " << tasks << "\n";
+    family("quicksort_sorts_total", "counter", "Sorts by engine.");
+    for (size_t e = 0; e < sizeof(METRIC_ENGINES) / sizeof(METRIC_ENGINES[0]); e++) {
+        out << "quicksort_sorts_total{engine=\"" << METRIC_ENGINES[e] << "\"} " << sorts_by_engine[e].load() << "\n";
+    }
+    family("quicksort_thread_busy_seconds_total", "counter", "Time each thread spent in quicksort tasks.");
+    for (int s = 0; s < slots; s++) {
+        out << "quicksort_thread_busy_seconds_total{slot=\"" << s << "\"} "
+            << thread_counters[s].busy_ns.load(memory_order_relaxed) * 1e-9 << "\n";
+    }
+    family("quicksort_thread_utilization", "gauge", "Busy share of the threads in the latest parallel quicksort.");
+    out << "quicksort_thread_utilization " << last_thread_utilization.load() << "\n";
+    family("quicksort_phase_duration_seconds", "histogram", "Duration of program phases.");
+    {
+        lock_guard<mutex> lock(phase_histograms_guard);
+        for (const auto& [name, histogram] : phase_histograms) {
+            for (int b = 0; b < 7; b++) {
+                out << "quicksort_phase_duration_seconds_bucket{phase=\"" << name << "\",le=\"";
+                if (b < 6) {
+                    out << PHASE_BUCKETS[b];
+                } else {
+                    out << "+Inf";
+                }
+                out << "\"} " << histogram.buckets[b] << "\n";
+            }
+            out << "quicksort_phase_duration_seconds_sum{phase=\"" << name << "\"} " << histogram.sum << "\n";
+            out << "quicksort_phase_duration_seconds_count{phase=\"" << name << "\"} " << histogram.count << "\n";
+        }
+    }
+    family("quicksort_threads", "gauge", "OpenMP threads available to the engines.");
+    out << "quicksort_threads " << omp_get_max_threads() << "\n";
+    family("quicksort_uptime_seconds", "gauge", "Seconds since the process started.");
+    out << "quicksort_uptime_seconds " << duration<double>(steady_clock::now() - process_start).count() << "\n";
+    return out.str();
+}
+
+/**
+ * @brief Replaces the --metrics-file file with the current metrics.
+ * 
+ * The text goes to a temporary file that is then renamed over the old one, so a scraper never reads a
+ * half-written file.
+ */
+void write_metrics_file() {
+    static mutex guard;
+    lock_guard<mutex> lock(guard);
+    if (metrics_file_closed) {
+        return;  // The exit snapshot is already written
+    }
+    string temporary = options.metrics_file + ".tmp";
+    ofstream outfile(temporary);
+    if (!outfile.is_open()) {
+        cerr << "Error opening file " << temporary << endl;
+        return;
+    }
+    outfile << metrics_text();
+    outfile.close();
+    rename(temporary.c_str(), options.metrics_file.c_str());
+}
+
+/**
+ * @brief Writes the final metrics snapshot at exit and stops the periodic rewrites.
+ */
+void close_metrics_file() {
+    write_metrics_file();
+    metrics_file_closed = true;
+}
+
+/**
+ * @brief Starts exposing metrics as requested by --metrics-file and --metrics-port.
+ * 
+ * The file is rewritten every METRICS_INTERVAL_MS and once more when the process exits. The port serves
+ * the same text over HTTP on 127.0.0.1 to any request path, one client at a time; a client that sends
+ * nothing for METRICS_SCRAPE_TIMEOUT_MS is dropped, so it cannot stall later scrapes. Both run on
+ * background threads; calling this again does nothing.
+ */
+void start_metrics_exporters() {
+    static bool started = false;
+    if (started) {
+        return;
+    }
+    started = true;
+    if (!options.metrics_file.empty()) {
+        atexit(close_metrics_file);
+        thread([] {
+            for (;;) {
+                write_metrics_file();
+                this_thread::sleep_for(milliseconds(METRICS_INTERVAL_MS));
+            }
+        }).detach();
+    }
+    if (options.metrics_port > 0) {
+        int listener = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons((uint16_t)options.metrics_port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (listener < 0 || ::bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+            cerr << "Error: cannot serve metrics on port " << options.metrics_port << endl;
+            return;
+        }
+        thread([listener] {
+            for (;;) {
+                int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+                if (fd < 0) {
+                    if (errno != EINTR && errno != ECONNABORTED) {
+                        this_thread::sleep_for(milliseconds(100));  // Out of fds or memory; let them free up
+                    }
+                    continue;
+                }
+                timeval timeout = {METRICS_SCRAPE_TIMEOUT_MS / 1000, (METRICS_SCRAPE_TIMEOUT_MS % 1000) * 1000};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                char request[4096];
+                if (recv(fd, request, sizeof(request), 0) <= 0) {
+                    close(fd);  // Silent or gone; serve the next client
+                    continue;
+                }
+                // Any request path gets the metrics
+                string body = metrics_text();
+                string response = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                  to_string(body.size()) + "\r\nConnection: close\r\n\r\n" + body;
+                send(fd, response.data(), response.size(), MSG_NOSIGNAL);
+                close(fd);
+            }
+        }).detach();
+    }
+}
+
+/**
+ * @brief Timing and memory traffic of one phase of the program.
+ */
+struct PhaseStat {
+    string name;     // Phase name, e.g. "read"
+    double seconds;  // Wall-clock time of the phase
+    double bytes;    // Estimated bytes moved to and from memory
+};
+
+vector<PhaseStat> phase_stats;
+
+/**
+ * @brief Records a finished phase for the roofline report.
+ * 
+ * @param name The phase name.
+ * @param start The time at which the phase started.
+ * @param bytes The estimated bytes the phase moved to and from memory.
+ */
+void record_phase(const string& name, high_resolution_clock::time_point start, double bytes) {
+    duration<double> elapsed = high_resolution_clock::now() - start;
+    phase_stats.push_back(PhaseStat{name, elapsed.count(), bytes});
+    observe_phase(name, elapsed.count());
+}
+
+/**
+ * @brief Returns the size of a file in bytes.
+ * 
+ * @param filename The name of the file.
+ * @return double The size of the file, or 0 if it does not exist.
+ */
+double file_size(const string& filename) {
+    struct stat info;
+    return stat(filename.c_str(), &info) == 0 ? (double)info.st_size : 0.0;
+}
+
+/**
+ * @brief Estimates the bytes an engine moves to and from memory while sorting.
+ * 
+ * The model counts each full sweep over data that does not fit in cache:
+ * - radix: a counting read plus a scatter read and write per pass, plus two sign-flip sweeps. The first
+ *   counting read is saved when the histogram was gathered while parsing;
+ * - aflag: the same three sweeps and two sign flips, done in place. It counts one pass per 8-bit level
+ *   of the parsed key range, or four levels without parse statistics;
+ * - narrowed radix: packing, the passes over the narrow keys and reading them back while formatting;
+ * - quicksort: a read and write of the array per partitioning level above the L2 cache size;
+ * - counting: a counting read and a rebuilding write;
+ * - merge: the run scan, the merge into a buffer and the copy back.
+ * 
+ * @param plan The engine that sorted the integers.
+ * @param n The number of integers sorted.
+ * @param parsed Optional statistics gathered while parsing, used for the key range.
+ * @return double The estimated number of bytes.
+ */
+double estimate_sort_traffic(const SortPlan& plan, size_t n, const ParseResult* parsed) {
+    double elements = (double)n;
+    int key_bits = 32;
+    if (parsed != nullptr && parsed->count == (int)n) {
+        uint32_t range = (uint32_t)parsed->max_value - (uint32_t)parsed->min_value;
+        for (key_bits = 1; key_bits < 32 && (range >> key_bits) != 0; key_bits++) {
+        }
+    }
+    bool fused = parsed != nullptr && parsed->histogram.threads > 0 && tuning.radix_bits == RADIX_BITS;
+
+    if (plan.narrow) {
+        double key_bytes = key_bits <= 8 ? 1 : key_bits <= 16 ? 2 : 4;
+        int passes = (key_bits + tuning.radix_bits - 1) / tuning.radix_bits;
+        return elements * (4 + key_bytes) + passes * 3 * elements * key_bytes - (fused ? elements * key_bytes : 0) +
+               elements * key_bytes;
+    }
+    if (plan.engine == "radix") {
+        int passes = (32 + tuning.radix_bits - 1) / tuning.radix_bits;
+        return passes * 3 * elements * 4 - (fused ? elements * 4 : 0) + 4 * elements * 4;
+    }
+    if (plan.engine == "aflag") {
+        int levels = (key_bits + RADIX_BITS - 1) / RADIX_BITS;
+        return levels * 3 * elements * 4 + 4 * elements * 4;
+    }
+    if (plan.engine == "counting") {
+        return 2 * elements * 4;
+    }
+    if (plan.engine == "merge") {
+        return 5 * elements * 4;
+    }
+    if (plan.engine == "quicksort") {
+        double levels = max(1.0, log2(elements * 4 / (double)topology.l2_bytes));
+        return 2 * elements * 4 * levels;
+    }
+    return 2 * elements * 4;
+}
+
+/**
+ * @brief Prints the time of every recorded phase and, given a peak, the fraction of it each achieved.
+ * 
+ * @param peak The peak memory bandwidth in GB/s, or 0 to print timings only.
+ */
+void report_phases(double peak) {
+    for (const PhaseStat& phase : phase_stats) {
+        double bandwidth = phase.seconds > 0 ? phase.bytes / phase.seconds / 1e9 : 0.0;
+        cout << "Phase " << phase.name << ": " << phase.seconds << " seconds, " << bandwidth << " GB/s";
+        if (peak > 0) {
+            cout << " (" << 100.0 * bandwidth / peak << "% of " << peak << " GB/s peak)";
+        }
+        cout << endl;
+    }
+}
+
+/**
+ * @brief Measures and prints the peak memory bandwidth.
+ * 
+ * Implements the "bandwidth" subcommand: ./quicksort_final bandwidth
+ * 
+ * @return int Returns 0.
+ */
+int bandwidth_command() {
+    cout << "Peak memory bandwidth: " << measure_peak_bandwidth() << " GB/s on " << omp_get_max_threads()
+         << " threads" << endl;
+    return 0;
+}
+
+/**
+ * @brief Loads a tuning profile of "name=value" lines into the global tuning parameters.
+ * 
+ * Blank lines, lines starting with '#' and unknown names are ignored, so profiles written by newer
+ * versions remain readable. Sizes and counts are clamped to their smallest usable value, and a
+ * radix_bits other than 8 or 11 is rejected with a warning.
+ * 
+ * @param filename The name of the profile file.
+ * @return bool True if the file was found and read.
+ */
+bool load_tuning_profile(const string& filename) {
+    ifstream infile(filename);
+    if (!infile.is_open()) {
+        return false;
+    }
+    string line;
+    while (getline(infile, line)) {
+        size_t eq = line.find('=');
+        if (line.empty() || line[0] == '#' || eq == string::npos) {
+            continue;
+        }
+        string name = line.substr(0, eq);
+        try {
+            if (name == "peak_bandwidth_gbs") {
+                tuning.peak_bandwidth_gbs = stod(line.substr(eq + 1));
+                continue;
+            }
+            long long value = stoll(line.substr(eq + 1));
+            if (name == "threads") {
+                tuning.threads = (int)min(max(0LL, value), (long long)INT_MAX);
+            } else if (name == "quicksort_cutoff") {
+                tuning.quicksort_cutoff = (int)min(max(1LL, value), (long long)INT_MAX);
+            } else if (name == "radix_bits") {
+                if (value != 8 && value != 11) {
+                    throw invalid_argument("radix_bits must be 8 or 11");  // The only digit widths radix_sort has
+                }
+                tuning.radix_bits = (int)value;
+            } else if (name == "parse_chunk_bytes") {
+                tuning.parse_chunk_bytes = (size_t)max(1LL, value);
+            } else if (name == "write_buffer_bytes") {
+                tuning.write_buffer_bytes = (size_t)max(64LL, value);
+            } else if (name == "plan_elements_per_thread") {
+                tuning.plan_elements_per_thread = (size_t)max(1LL, value);
+            } else if (name == "prefetch_partition") {
+                tuning.prefetch_partition = (int)max(0LL, value);
+            } else if (name == "prefetch_merge") {
+                tuning.prefetch_merge = (int)max(0LL, value);
+            } else if (name == "prefetch_scatter") {
+                tuning.prefetch_scatter = (int)max(0LL, value);
+            }
+        } catch (exception &err) {
+            cerr << "Warning: Ignoring invalid line in " << filename << ": " << line << endl;
+        }
+    }
+    if (tuning.threads > 0) {
+        omp_set_num_threads(tuning.threads);
+    }
+    return true;
+}
+
+/**
+ * @brief Writes the global tuning parameters to a profile file.
+ * 
+ * @param filename The name of the profile file.
+ * @return bool True if the file was written.
+ */
+bool save_tuning_profile(const string& filename) {
+    ofstream outfile(filename);
+    if (!outfile.is_open()) {
+        cerr << "Error opening file " << filename << endl;
+        return false;
+    }
+    outfile << "# Tuning profile written by \"quicksort_final tune\"" << endl;
+    outfile << "threads=" << tuning.threads << endl;
+    outfile << "quicksort_cutoff=" << tuning.quicksort_cutoff << endl;
+    outfile << "radix_bits=" << tuning.radix_bits << endl;
+    outfile << "parse_chunk_bytes=" << tuning.parse_chunk_bytes << endl;
+    outfile << "write_buffer_bytes=" << tuning.write_buffer_bytes << endl;
+    outfile << "plan_elements_per_thread=" << tuning.plan_elements_per_thread << endl;
+    outfile << "peak_bandwidth_gbs=" << tuning.peak_bandwidth_gbs << endl;
+    outfile << "prefetch_partition=" << tuning.prefetch_partition << endl;
+    outfile << "prefetch_merge=" << tuning.prefetch_merge << endl;
+    outfile << "prefetch_scatter=" << tuning.prefetch_scatter << endl;
+    return true;
+}
+
+/**
+ * @brief Runs a benchmark several times and returns its fastest time.
+ * 
+ * @param prepare Called before every repetition, outside the timed region.
+ * @param run The code to time.
+ * @return double The best time in seconds.
+ */
+template <typename Prepare, typename Run>
+double best_time(Prepare prepare, Run run) {
+    double best = 1e30;
+    for (int rep = 0; rep < TUNE_REPS; rep++) {
+        prepare();
+        auto start = high_resolution_clock::now();
+        run();
+        duration<double> elapsed = high_resolution_clock::now() - start;
+        best = min(best, elapsed.count());
+    }
+    return best;
+}
+
+/**
+ * @brief Benchmarks each candidate value of one tuning parameter and keeps the fastest.
+ * 
+ * @param name The parameter name, as written in the profile.
+ * @param candidates The values to try.
+ * @param apply Stores a candidate value in the global tuning parameters.
+ * @param prepare Called before every repetition, outside the timed region.
+ * @param run The benchmark to time.
+ * @return long long The fastest candidate, which is left applied.
+ */
+template <typename Apply, typename Prepare, typename Run>
+long long tune_parameter(const string& name, const vector<long long>& candidates, Apply apply, Prepare prepare, Run run) {
+    long long best_value = candidates.front();
+    double best = 1e30;
+    for (long long candidate : candidates) {
+        apply(candidate);
+        double seconds = best_time(prepare, run);
+        cout << "  " << name << "=" << candidate << ": " << seconds << " seconds" << endl;
+        if (seconds < best) {
+            best = seconds;
+            best_value = candidate;
+        }
+    }
+    apply(best_value);
+    return best_value;
+}
+
+/**
+ * @brief Benchmarks the software prefetch distances of the partition, merge and radix scatter kernels.
+ * 
+ * Each distance is timed on copies of 'input': quicksort for the partition scans, a loser-tree merge
+ * of PREFETCH_BENCH_RUNS sorted runs for the merge, and a radix sort with direct (unstaged) scatter for
+ * the scatter. The fastest distance of each kernel is left in the global tuning parameters.
+ * 
+ * @param input The integers to benchmark with.
+ */
+void tune_prefetch_distances(const vector<int>& input) {
+    size_t n = input.size();
+    vector<int> work(n);
+    auto reset = [&]() { memcpy(work.data(), input.data(), n * sizeof(int)); };
+    vector<long long> distances = {0, 8, 16, 32, 64, 128};
+
+    tune_parameter("prefetch_partition", distances, [](long long v) { tuning.prefetch_partition = (int)v; }, reset, [&]() {
+        #pragma omp parallel
+        {
+            #pragma omp single
+            quickSort(work.data(), 0, (int)n - 1);
+        }
+    });
+
+    vector<int> runs(input);
+    size_t run_count = min((size_t)PREFETCH_BENCH_RUNS, max(n, (size_t)1));
+    for (size_t r = 0; r < run_count; r++) {
+        sort(runs.begin() + n * r / run_count, runs.begin() + n * (r + 1) / run_count);
+    }
+    tune_parameter("prefetch_merge", distances, [](long long v) { tuning.prefetch_merge = (int)v; }, []() {}, [&]() {
+        vector<ArrayRunReader> readers;
+        vector<ArrayRunReader*> pointers;
+        for (size_t r = 0; r < run_count; r++) {
+            readers.emplace_back(runs.data() + n * r / run_count, runs.data() + n * (r + 1) / run_count);
+        }
+        for (ArrayRunReader& reader : readers) {
+            pointers.push_back(&reader);
+        }
+        ArrayWriter writer(work.data());
+        merge_runs(pointers, writer);
+    });
+
+    bool write_combining = options.write_combining;
+    options.write_combining = false;
+    tune_parameter("prefetch_scatter", distances, [](long long v) { tuning.prefetch_scatter = (int)v; }, reset,
+                   [&]() { radix_sort_numbers(work.data(), n); });
+    options.write_combining = write_combining;
+}
+
+/**
+ * @brief Measures how software prefetching affects the partition, merge and scatter kernels.
+ * 
+ * Implements the "bench-prefetch" subcommand: ./quicksort_final bench-prefetch [n]. The default size is
+ * twice the L3 cache, so the kernels stream from main memory.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon success and 1 on invalid arguments.
+ */
+int bench_prefetch_command(int argc, char* argv[]) {
+    size_t n = min(max(2 * topology.l3_bytes / sizeof(int), (size_t)1 << 24), (size_t)1 << 27);
+    if (argc > 2) {
+        try {
+            n = stoul(argv[2]);
+        } catch (exception &err) {
+            cerr << "Error: The number of integers must be an integer." << endl;
+            return 1;
+        }
+    }
+    vector<int> input(n);
+    mt19937 generator(12345);
+    for (size_t i = 0; i < n; i++) {
+        input[i] = (int)generator();
+    }
+    cout << "Prefetch distances on " << n << " integers (" << n * sizeof(int) / (1 << 20) << " MiB) and "
+         << omp_get_max_threads() << " threads" << endl;
+    tune_prefetch_distances(input);
+    cout << "Fastest: prefetch_partition=" << tuning.prefetch_partition << " prefetch_merge=" << tuning.prefetch_merge
+         << " prefetch_scatter=" << tuning.prefetch_scatter << endl;
+    return 0;
+}
+
+/**
+ * @brief Benchmarks the tunable parameters on this machine and writes them to the tuning profile.
+ * 
+ * Implements the "tune" subcommand: ./quicksort_final tune [n]. The thread count is chosen first and
+ * the remaining parameters are measured with it: the quicksort task cutoff, the radix digit width and
+ * the parser chunk size, followed by the software prefetch distances. The peak memory bandwidth is
+ * stored for roofline reports. Parameters that are not benchmarked keep their topology-derived
+ * defaults. Later runs load TUNING_FILE automatically.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon success and 1 on failure.
+ */
+int tune_command(int argc, char* argv[]) {
+    size_t n = TUNE_N;
+    if (argc > 2) {
+        try {
+            n = stoul(argv[2]);
+        } catch (exception &err) {
+            cerr << "Error: The number of integers must be an integer." << endl;
+            return 1;
+        }
+    }
+    apply_topology_defaults();
+    vector<int> input(n);
+    vector<int> work(n);
+    mt19937 generator(12345);
+    for (size_t i = 0; i < n; i++) {
+        input[i] = (int)generator();
+    }
+    auto reset = [&]() { memcpy(work.data(), input.data(), n * sizeof(int)); };
+    auto radix = [&]() { radix_sort_numbers(work.data(), n); };
+    auto quicksort = [&]() {
+        #pragma omp parallel
+        {
+            #pragma omp single
+            quickSort(work.data(), 0, (int)n - 1);
+        }
+    };
+    cout << "Tuning with " << n << " integers" << endl;
+
+    vector<long long> thread_counts;
+    for (int t = 1; t < omp_get_num_procs(); t *= 2) {
+        thread_counts.push_back(t);
+    }
+    thread_counts.push_back(omp_get_num_procs());
+    tune_parameter("threads", thread_counts,
+                   [](long long v) { tuning.threads = (int)v; omp_set_num_threads((int)v); }, reset, radix);
+    tune_parameter("quicksort_cutoff", {100, 1000, 10000, 100000},
+                   [](long long v) { tuning.quicksort_cutoff = (int)v; }, reset, quicksort);
+    tune_parameter("radix_bits", {8, 11},
+                   [](long long v) { tuning.radix_bits = (int)v; }, reset, radix);
+
+    write_numbers_to_file(input.data(), (int)n, TUNE_FILE);
+    ParseResult parsed;
+    tune_parameter("parse_chunk_bytes", {1 << 16, 1 << 18, 1 << 20, 1 << 22, 1 << 24},
+                   [](long long v) { tuning.parse_chunk_bytes = (size_t)v; }, []() {},
+                   [&]() { read_numbers_with_histogram(work.data(), (int)n, TUNE_FILE, parsed); });
+    remove(TUNE_FILE);
+
+    tune_prefetch_distances(input);
+
+    tuning.peak_bandwidth_gbs = measure_peak_bandwidth();
+    cout << "  peak_bandwidth_gbs=" << tuning.peak_bandwidth_gbs << endl;
+
+    if (!save_tuning_profile(TUNING_FILE)) {
+        return 1;
+    }
+    cout << "Tuning profile written to " << TUNING_FILE << endl;
+    return 0;
+}
+
+/**
+ * @brief Applies a "--name" or "--name=value" command-line flag to the global options.
+ * 
+ * @param arg The flag as given on the command line.
+ * @return bool False if the flag is not recognised.
+ */
+bool parse_option(const string& arg) {
+    size_t eq = arg.find('=');
+    string name = arg.substr(2, eq == string::npos ? string::npos : eq - 2);
+    string value = eq == string::npos ? "" : arg.substr(eq + 1);
+    if (name == "engine" && (value == "auto" || value == "quicksort" || value == "radix" || value == "aflag" ||
+                             value == "counting" || value == "merge" || value == "network")) {
+        options.engine = value;
+    } else if (name == "no-wc") {
+        options.write_combining = false;
+    } else if (name == "no-nt") {
+        options.streaming_stores = false;
+    } else if (name == "narrow") {
+        options.narrow = true;
+    } else if (name == "roofline") {
+        options.roofline = true;
+    } else if (name == "unique" && (value == "" || value == "counts")) {
+        options.unique = true;
+        options.unique_counts = value == "counts";
+    } else if (name == "head" && !value.empty() && value.find_first_not_of("0123456789") == string::npos) {
+        options.head = stoll(value);
+    } else if (name == "early-emit") {
+        options.early_emit = true;
+    } else if (name == "async") {
+        options.async_io = true;
+    } else if (name == "pipeline") {
+        options.pipeline = true;
+    } else if (name == "memory-limit" && !value.empty() && value.find_first_not_of("0123456789") == string::npos) {
+        options.memory_limit = stoull(value) << 20;
+    } else if (name == "metrics-file" && !value.empty()) {
+        options.metrics_file = value;
+    } else if (name == "stats-file" && !value.empty()) {
+        options.stats_file = value;
+    } else if (name == "metrics-port" && !value.empty() && value.find_first_not_of("0123456789") == string::npos) {
+        options.metrics_port = stoi(value);
+    } else if (name == "bitmap" && (value == "" || value == "dense" || value == "roaring")) {
+        options.bitmap = value == "" ? "auto" : value;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief A fixed-capacity queue that hands work from one pipeline stage to the next.
+ * 
+ * push blocks while the queue is full, which applies back-pressure to the producing stage, and pop
+ * blocks until an item arrives or the queue is closed and drained.
+ */
+template <typename T>
+class BoundedQueue {
+public:
+    /**
+     * @brief Creates an empty queue.
+     * 
+     * @param capacity The largest number of items the queue holds before push blocks.
+     */
+    explicit BoundedQueue(size_t capacity) : capacity(capacity) {}
+
+    /**
+     * @brief Appends an item, waiting for room if the queue is full. Items pushed after close are dropped.
+     * 
+     * @param item The item to append.
+     */
+    void push(T item) {
+        unique_lock<mutex> lock(guard);
+        not_full.wait(lock, [&] { return items.size() < capacity || closed; });
+        if (closed) {
+            return;
+        }
+        items.push_back(move(item));
+        not_empty.notify_one();
+    }
+
+    /**
+     * @brief Removes the oldest item, waiting for one if the queue is empty.
+     * 
+     * @param item Receives the removed item.
+     * @return bool False once the queue is closed and empty.
+     */
+    bool pop(T& item) {
+        unique_lock<mutex> lock(guard);
+        not_empty.wait(lock, [&] { return !items.empty() || closed; });
+        if (items.empty()) {
+            return false;
+        }
+        item = move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Removes the oldest item, waiting for one until a deadline.
+     * 
+     * @param item Receives the removed item.
+     * @param deadline When to give up waiting.
+     * @return bool False if the deadline passed or the queue is closed while it is empty.
+     */
+    bool pop_until(T& item, high_resolution_clock::time_point deadline) {
+        unique_lock<mutex> lock(guard);
+        if (!not_empty.wait_until(lock, deadline, [&] { return !items.empty() || closed; }) || items.empty()) {
+            return false;
+        }
+        item = move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    /**
+     * @brief Marks the end of the stream; consumers drain the remaining items and then stop.
+     */
+    void close() {
+        lock_guard<mutex> lock(guard);
+        closed = true;
+        not_empty.notify_all();
+        not_full.notify_all();
+    }
+
+private:
+    size_t capacity;
+    deque<T> items;
+    bool closed = false;
+    mutex guard;
+    condition_variable not_full;
+    condition_variable not_empty;
+};
+
+/**
+ * @brief Accounts for the memory held by jobs in flight and blocks new jobs while the budget is used up.
+ * 
+ * A reservation larger than the whole budget is granted once nothing else is reserved, so an oversized
+ * job runs alone instead of never running.
+ */
+class MemoryBudget {
+public:
+    /**
+     * @brief Creates a budget.
+     * 
+     * @param limit The number of bytes that may be reserved at once.
+     */
+    explicit MemoryBudget(size_t limit) : limit(limit) {}
+
+    /**
+     * @brief Reserves memory, waiting until it fits in the budget.
+     * 
+     * @param bytes The number of bytes to reserve.
+     */
+    void acquire(size_t bytes) {
+        unique_lock<mutex> lock(guard);
+        released.wait(lock, [&] { return used == 0 || used + bytes <= limit; });
+        used += bytes;
+        peak = max(peak, used);
+    }
+
+    /**
+     * @brief Reserves memory if it fits in the budget right now.
+     * 
+     * @param bytes The number of bytes to reserve.
+     * @return bool True if the memory was reserved.
+     */
+    bool try_acquire(size_t bytes) {
+        lock_guard<mutex> lock(guard);
+        if (used != 0 && used + bytes > limit) {
+            return false;
+        }
+        used += bytes;
+        peak = max(peak, used);
+        return true;
+    }
+
+    /**
+     * @brief Returns memory to the budget.
+     * 
+     * @param bytes The number of bytes to release.
+     */
+    void release(size_t bytes) {
+        lock_guard<mutex> lock(guard);
+        used -= bytes;
+        released.notify_all();
+    }
+
+    /**
+     * @brief Returns the largest number of bytes reserved at once.
+     * 
+     * @return size_t The peak reservation.
+     */
+    size_t peak_bytes() {
+        lock_guard<mutex> lock(guard);
+        return peak;
+    }
+
+private:
+    size_t limit;
+    size_t used = 0;
+    size_t peak = 0;
+    mutex guard;
+    condition_variable released;
+};
+
+/**
+ * @brief One input file travelling through the batch pipeline.
+ */
+struct BatchJob {
+    string input;                 // Path of the CSV file to sort
+    string output;                // Path of the sorted CSV file to write
+    size_t size = 0;              // Bytes of the input file
+    vector<char> text;            // Contents loaded by the --async reader, parsed by the sort stage
+    bool loaded = false;          // Whether the --async reader loaded the file
+    vector<int> numbers;          // Parsed integers, sorted in place by the sort stage
+    ParseResult parsed;           // Statistics gathered while parsing
+    size_t reserved = 0;          // Bytes reserved from the memory budget
+    SortPlan plan;                // Engine chosen by the sort stage
+};
+
+/**
+ * @brief Expands the input arguments of the batch subcommand into file paths.
+ * 
+ * An argument starting with '@' names a file listing one path per line, an argument holding '*', '?'
+ * or '[' is expanded as a glob pattern, and any other argument is taken as a path.
+ * 
+ * @param arg The argument to expand.
+ * @param paths Receives the expanded paths.
+ */
+void expand_batch_inputs(const string& arg, vector<string>& paths) {
+    if (arg[0] == '@') {
+        ifstream list(arg.substr(1));
+        if (!list.is_open()) {
+            cerr << "Error opening file " << arg.substr(1) << endl;
+        }
+        string line;
+        while (getline(list, line)) {
+            if (!line.empty()) {
+                paths.push_back(line);
+            }
+        }
+    } else if (arg.find_first_of("*?[") != string::npos) {
+        glob_t matches;
+        if (glob(arg.c_str(), 0, nullptr, &matches) == 0) {
+            for (size_t i = 0; i < matches.gl_pathc; i++) {
+                paths.push_back(matches.gl_pathv[i]);
+            }
+        }
+        globfree(&matches);
+    } else {
+        paths.push_back(arg);
+    }
+}
+
+/**
+ * @brief Sorts many CSV files in one process, overlapping parsing, sorting and writing.
+ * 
+ * Implements the "batch" subcommand: ./quicksort_final batch [flags] <output-dir> <inputs>... Each input
+ * is sorted into a file of the same name in the output directory; inputs from different directories that
+ * share a name are refused rather than overwriting each other. The work runs as a three-stage
+ * pipeline joined by bounded queues:
+ * - parse: --io-threads (default 1) threads reading and parsing files one at a time, each with a
+ *   single-threaded parser so the CPU stays with the sorter,
+ * - sort: the calling thread, which plans and sorts each file with the whole OpenMP team,
+ * - write: one thread formatting the sorted files.
+ * A file is admitted to the pipeline only once its memory fits in --memory-limit (default: half of
+ * physical memory). It reserves four times its file size, which bounds the text and the parsed
+ * integers in the worst case of one-digit numbers, and drops to eight bytes per integer (the array
+ * and the radix buffer) once parsed. With --async the parse threads are replaced by one thread that
+ * keeps up to ASYNC_FILES file loads in flight on an IoReactor, the sort stage parses the loaded
+ * text with the whole team, and the writer hands its blocks to a reactor of its own.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 if every file was sorted and 1 otherwise.
+ */
+int batch_command(int argc, char* argv[]) {
+    int io_threads = 1;
+    int first = 2;
+    for (; first < argc && string(argv[first]).rfind("--", 0) == 0; first++) {
+        string arg = argv[first];
+        if (arg.rfind("--io-threads=", 0) == 0) {
+            io_threads = max(1, atoi(arg.c_str() + 13));
+        } else if (!parse_option(arg)) {
+            cerr << "Error: Unknown option " << arg << endl;
+            return 1;
+        }
+    }
+    if (options.head > 0) {
+        cerr << "Error: --head is not supported by batch, which always writes every integer." << endl;
+        return 1;
+    }
+    start_metrics_exporters();
+    install_stats_handler();
+    if (argc - first < 2) {
+        cerr << "Usage: " << argv[0] << " batch [--io-threads=k] [--memory-limit=MiB] [flags] <output-dir> <inputs|pattern|@list>..." << endl;
+        return 1;
+    }
+    string outdir = argv[first];
+    mkdir(outdir.c_str(), 0755);
+    vector<string> inputs;
+    for (int i = first + 1; i < argc; i++) {
+        expand_batch_inputs(argv[i], inputs);
+    }
+    vector<string> listed;
+    inputs.swap(listed);
+    for (const string& path : listed) {
+        if (find(inputs.begin(), inputs.end(), path) == inputs.end()) {
+            inputs.push_back(path);  // A file named twice would be written twice at the same time
+        }
+    }
+    map<string, string> outputs;
+    for (const string& path : inputs) {
+        string name = path.substr(path.find_last_of('/') + 1);
+        auto [taken, added] = outputs.emplace(name, path);
+        if (!added) {
+            cerr << "Error: " << taken->second << " and " << path << " would both be written to " << outdir << "/"
+                 << name << endl;
+            return 1;
+        }
+    }
+    size_t limit = options.memory_limit > 0 ? options.memory_limit
+                                            : (size_t)sysconf(_SC_PHYS_PAGES) * (size_t)sysconf(_SC_PAGE_SIZE) / 2;
+    cout << "Batch of " << inputs.size() << " files with " << io_threads << " parse threads and a "
+         << (limit >> 20) << " MiB memory budget" << endl;
+    auto start = high_resolution_clock::now();
+    enter_phase("batch", inputs.size(), "files written");
+
+    MemoryBudget budget(limit);
+    BoundedQueue<BatchJob*> to_sort(2 * io_threads);
+    BoundedQueue<BatchJob*> to_write(2);
+    atomic<size_t> next_input(0);
+    atomic<int> failures(0);
+    atomic<long long> parse_ns(0);
+    atomic<long long> write_ns(0);
+
+    // Creates the job of an input and reserves its memory, waiting for room or giving up if there is none
+    auto admit = [&](size_t i, bool wait) -> BatchJob* {
+        BatchJob* job = new BatchJob;
+        job->input = inputs[i];
+        size_t slash = job->input.find_last_of('/');
+        job->output = outdir + "/" + (slash == string::npos ? job->input : job->input.substr(slash + 1));
+        struct stat info;
+        job->size = stat(job->input.c_str(), &info) == 0 ? (size_t)info.st_size : 0;
+        job->reserved = 4 * job->size;
+        if (wait) {
+            budget.acquire(job->reserved);
+        } else if (!budget.try_acquire(job->reserved)) {
+            delete job;
+            return nullptr;
+        }
+        return job;
+    };
+    // Parses the loaded text or the file of a job and shrinks its reservation to the parsed integers
+    auto parse = [&](BatchJob* job) -> bool {
+        auto begin = high_resolution_clock::now();
+        job->numbers.resize(min(job->size / 2 + 1, (size_t)INT_MAX));
+        int count;
+        if (!options.async_io) {
+            count = read_numbers_with_histogram(job->numbers.data(), (int)job->numbers.size(), job->input, job->parsed);
+        } else if (job->loaded) {
+            count = parse_numbers_with_histogram(job->text, job->numbers.data(), (int)job->numbers.size(), job->input, job->parsed);
+            vector<char>().swap(job->text);
+        } else {
+            cerr << "Error opening file " << job->input << endl;
+            count = -1;
+        }
+        if (count < 0) {
+            failures++;
+            budget.release(job->reserved);
+            delete job;
+            return false;
+        }
+        job->numbers.resize(count);
+        job->numbers.shrink_to_fit();  // Give back the worst-case parse buffer before lowering the reservation
+        size_t needed = 8 * (size_t)count;
+        if (needed < job->reserved) {
+            budget.release(job->reserved - needed);
+            job->reserved = needed;
+        }
+        parse_ns += duration_cast<nanoseconds>(high_resolution_clock::now() - begin).count();
+        return true;
+    };
+
+    vector<thread> parsers;
+    if (options.async_io) {
+        // One thread keeps up to ASYNC_FILES loads in flight; the sort stage parses them with the whole team
+        parsers.emplace_back([&] {
+            IoReactor reactor;
+            vector<BatchJob*> loaded;
+            size_t i = 0;
+            while (i < inputs.size() || reactor.tasks() > 0) {
+                while (i < inputs.size() && reactor.tasks() < ASYNC_FILES) {
+                    BatchJob* job = admit(i, reactor.tasks() == 0);
+                    if (job == nullptr) {
+                        break;  // Wait for memory to be released by the later stages
+                    }
+                    i++;
+                    reactor.spawn(async_load_file(reactor, job->input, job->text, [job, &loaded](bool ok) {
+                        job->loaded = ok;
+                        loaded.push_back(job);
+                    }));
+                }
+                reactor.run_once(true);
+                for (BatchJob* job : loaded) {
+                    to_sort.push(job);
+                }
+                loaded.clear();
+            }
+        });
+    }
+    for (int p = 0; p < io_threads && !options.async_io; p++) {
+        parsers.emplace_back([&] {
+            omp_set_num_threads(1);
+            for (size_t i = next_input++; i < inputs.size(); i = next_input++) {
+                BatchJob* job = admit(i, true);
+                if (parse(job)) {
+                    to_sort.push(job);
+                }
+            }
+        });
+    }
+    thread writer([&] {
+        IoReactor reactor;
+        BatchJob* job;
+        while (to_write.pop(job)) {
+            auto begin = high_resolution_clock::now();
+            if (options.unique) {
+                write_unique_numbers_to_file(job->numbers.data(), job->numbers.size(), job->output, options.unique_counts);
+            } else {
+                BufferedCsvWriter out(job->output, options.async_io ? &reactor : nullptr);
+                if (!out.is_open()) {
+                    cerr << "Error opening file " << job->output << endl;
+                    failures++;
+                }
+                for (size_t i = 0; out.is_open() && i < job->numbers.size(); i++) {
+                    out.put(job->numbers[i]);
+                }
+            }
+            write_ns += duration_cast<nanoseconds>(high_resolution_clock::now() - begin).count();
+            cout << "  " << job->input << ": " << job->numbers.size() << " numbers, " << job->plan.engine
+                 << " on " << job->plan.threads << " threads -> " << job->output << endl;
+            budget.release(job->reserved);
+            delete job;
+            phase_progress.done.fetch_add(1, memory_order_relaxed);
+        }
+    });
+    thread closer([&] {
+        for (thread& parser : parsers) {
+            parser.join();
+        }
+        to_sort.close();
+    });
+
+    // Sort on this thread with the full OpenMP team while the other stages work on their files
+    BatchJob* job;
+    long long sort_ns = 0;
+    long long numbers = 0;
+    while (to_sort.pop(job)) {
+        if (options.async_io && !parse(job)) {
+            continue;
+        }
+        auto begin = high_resolution_clock::now();
+        if (job->parsed.histogram.threads != omp_get_max_threads()) {
+            job->parsed.histogram = RadixHistogram();  // Parsed by fewer threads than will sort it
+        }
+        int count = (int)job->numbers.size();
+        if (count > 0) {
+            job->plan = plan_sort(job->numbers.data(), count, &job->parsed);
+            job->plan.narrow = false;  // Narrowing fuses the write into the sort, so keep the full keys
+            sort_numbers(job->numbers.data(), count, job->plan, &job->parsed);
+        }
+        sort_ns += duration_cast<nanoseconds>(high_resolution_clock::now() - begin).count();
+        numbers += count;
+        to_write.push(job);
+    }
+    closer.join();
+    to_write.close();
+    writer.join();
+
+    duration<double> execution_time = high_resolution_clock::now() - start;
+    cout << "Sorted " << numbers << " numbers from " << inputs.size() - failures << " of " << inputs.size()
+         << " files into " << outdir << endl;
+    cout << "Stage busy time: parse " << parse_ns / 1e9 << " s, sort " << sort_ns / 1e9 << " s, write "
+         << write_ns / 1e9 << " s" << endl;
+    cout << "Peak memory reserved: " << (budget.peak_bytes() >> 20) << " MiB of " << (limit >> 20) << " MiB" << endl;
+    cout << "Execution time: " << execution_time.count() << " seconds" << endl;
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * @brief Collects merged integers into blocks and hands full blocks to the writer stage of the pipeline.
+ */
+class BlockSink {
+public:
+    /**
+     * @brief Starts an empty block.
+     * 
+     * @param queue The queue feeding the writer stage.
+     */
+    explicit BlockSink(BoundedQueue<vector<int>*>& queue) : queue(queue) {
+        block = new vector<int>;
+        block->reserve(PIPELINE_BLOCK);
+    }
+
+    /**
+     * @brief Appends an integer, passing the block on once it is full.
+     * 
+     * @param value The integer to write.
+     */
+    void put(int value) {
+        block->push_back(value);
+        if (block->size() == PIPELINE_BLOCK) {
+            queue.push(block);
+            block = new vector<int>;
+            block->reserve(PIPELINE_BLOCK);
+        }
+    }
+
+    /**
+     * @brief Passes on the last partial block and ends the stream.
+     */
+    void finish() {
+        queue.push(block);
+        queue.close();
+    }
+
+private:
+    BoundedQueue<vector<int>*>& queue;
+    vector<int>* block;
+};
+
+/**
+ * @brief Sorts a CSV file with a staged pipeline whose stages run on dedicated threads.
+ * 
+ * Used by --pipeline. A reader thread parses the file PIPELINE_CHUNK integers at a time, and a sorter
+ * thread sorts each chunk with the OpenMP team while the next one is parsed. The two are joined by a
+ * queue of two chunks, so the reader stalls instead of racing ahead when sorting is slower. Once the
+ * input ends, the calling thread merges the sorted chunks. It hands blocks of PIPELINE_BLOCK integers to a
+ * writer thread, which formats the output while the merge continues. End-to-end time approaches
+ * max(read, sort) + max(merge, write) rather than the sum of all four.
+ * 
+ * @param input The name of the CSV file to sort.
+ * @param output The name of the sorted CSV file to write.
+ * @return int The number of integers sorted, or -1 if a file could not be opened or the input is invalid.
+ */
+int pipeline_sort_file(const string& input, const string& output) {
+    CsvRunReader in(input);
+    BufferedCsvWriter out(output);
+    if (!in.is_open() || !out.is_open()) {
+        cerr << "Error opening file " << (in.is_open() ? output : input) << endl;
+        return -1;
+    }
+    BoundedQueue<vector<int>*> parsed(2);
+    BoundedQueue<vector<int>*> merged(2);
+    long long read_ns = 0;
+    long long sort_ns = 0;
+    long long write_ns = 0;
+    vector<vector<int>*> runs;
+    auto start = high_resolution_clock::now();
+
+    thread reader([&] {
+        for (bool more = true; more; ) {
+            auto begin = high_resolution_clock::now();
+            vector<int>* chunk = new vector<int>(PIPELINE_CHUNK);
+            size_t m = 0;
+            while (m < chunk->size() && (more = in.next((*chunk)[m]))) {
+                m++;
+            }
+            chunk->resize(m);
+            read_ns += duration_cast<nanoseconds>(high_resolution_clock::now() - begin).count();
+            if (m == 0) {
+                delete chunk;
+                break;
+            }
+            parsed.push(chunk);
+        }
+        parsed.close();
+    });
+    thread sorter([&] {
+        vector<int>* chunk;
+        while (parsed.pop(chunk)) {
+            auto begin = high_resolution_clock::now();
+            SortPlan plan = plan_sort(chunk->data(), chunk->size(), nullptr);
+            plan.narrow = false;  // Chunks are merged in full width
+            sort_numbers(chunk->data(), (int)chunk->size(), plan);
+            sort_ns += duration_cast<nanoseconds>(high_resolution_clock::now() - begin).count();
+            runs.push_back(chunk);
+        }
+    });
+    thread writer([&] {
+        UniqueWriter unique_writer(out, options.unique_counts);
+        vector<int>* block;
+        while (merged.pop(block)) {
+            auto begin = high_resolution_clock::now();
+            for (int value : *block) {
+                if (options.unique) {
+                    unique_writer.put(value);
+                } else {
+                    out.put(value);
+                }
+            }
+            delete block;
+            write_ns += duration_cast<nanoseconds>(high_resolution_clock::now() - begin).count();
+        }
+        unique_writer.finish();
+        out.flush();
+    });
+    reader.join();
+    sorter.join();
+
+    // Merge the sorted chunks on this thread, streaming the result to the writer
+    auto begin = high_resolution_clock::now();
+    vector<ArrayRunReader*> readers;
+    size_t count = 0;
+    for (vector<int>* run : runs) {
+        readers.push_back(new ArrayRunReader(run->data(), run->data() + run->size()));
+        count += run->size();
+    }
+    BlockSink sink(merged);
+    if (!readers.empty()) {
+        merge_runs(readers, sink);
+    }
+    sink.finish();
+    double merge_seconds = duration<double>(high_resolution_clock::now() - begin).count();
+    writer.join();
+    for (size_t i = 0; i < runs.size(); i++) {
+        delete readers[i];
+        delete runs[i];
+    }
+    if (in.failed()) {
+        cerr << "Error: " << input << " holds a number that is missing its digits or does not fit in 32 bits" << endl;
+        return -1;
+    }
+
+    duration<double> wall = high_resolution_clock::now() - start;
+    cout << "Numbers written to " << output << endl;
+    cout << "Pipeline over " << runs.size() << " chunks: read " << read_ns / 1e9 << " s, sort " << sort_ns / 1e9
+         << " s, merge " << merge_seconds << " s, write " << write_ns / 1e9 << " s busy in " << wall.count()
+         << " s" << endl;
+    return (int)count;
+}
+
+/**
+ * @brief Sends a whole buffer over a socket, retrying partial sends.
+ * 
+ * @param fd The socket.
+ * @param data The bytes to send.
+ * @param bytes The number of bytes.
+ * @return bool False if the connection failed.
+ */
+bool send_all(int fd, const void* data, size_t bytes) {
+    const char* p = (const char*)data;
+    while (bytes > 0) {
+        ssize_t sent = send(fd, p, bytes, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += sent;
+        bytes -= (size_t)sent;
+    }
+    return true;
+}
+
+/**
+ * @brief Receives exactly the requested number of bytes from a socket.
+ * 
+ * @param fd The socket.
+ * @param data The memory receiving the bytes.
+ * @param bytes The number of bytes.
+ * @return bool False if the connection closed or failed first.
+ */
+bool recv_all(int fd, void* data, size_t bytes) {
+    char* p = (char*)data;
+    while (bytes > 0) {
+        ssize_t got = recv(fd, p, bytes, 0);
+        if (got <= 0) {
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += got;
+        bytes -= (size_t)got;
+    }
+    return true;
+}
+
+/**
+ * @brief Sends one array of integers to every peer and receives one from each, all at once.
+ * 
+ * Every outgoing array is sent on its own thread while the calling thread receives the incoming arrays
+ * in rank order, so two peers sending large arrays to each other cannot block one another. Each array
+ * travels as a 64-bit length followed by the integers; a length above INT_MAX, more than a worker can
+ * hold, fails the exchange instead of being allocated.
+ * 
+ * @param peers The socket of every peer, or -1 for this worker's own rank.
+ * @param outgoing The array for each rank; the own rank's array is moved to incoming unchanged.
+ * @param incoming Receives the array from each rank.
+ * @return bool False if a connection failed.
+ */
+bool exchange_all_to_all(const vector<int>& peers, vector<vector<int>>& outgoing, vector<vector<int>>& incoming) {
+    size_t ranks = peers.size();
+    incoming.assign(ranks, vector<int>());
+    atomic<bool> ok(true);
+    vector<thread> senders;
+    for (size_t r = 0; r < ranks; r++) {
+        if (peers[r] < 0) {
+            incoming[r].swap(outgoing[r]);
+            continue;
+        }
+        senders.emplace_back([&, r] {
+            uint64_t count = outgoing[r].size();
+            if (!send_all(peers[r], &count, sizeof(count)) ||
+                !send_all(peers[r], outgoing[r].data(), count * sizeof(int))) {
+                ok = false;
+            }
+        });
+    }
+    for (size_t r = 0; r < ranks; r++) {
+        if (peers[r] < 0) {
+            continue;
+        }
+        uint64_t count = 0;
+        if (!recv_all(peers[r], &count, sizeof(count)) || count > (uint64_t)INT_MAX) {
+            ok = false;
+            continue;
+        }
+        incoming[r].resize(count);
+        if (!recv_all(peers[r], incoming[r].data(), count * sizeof(int))) {
+            ok = false;
+        }
+    }
+    for (thread& sender : senders) {
+        sender.join();
+    }
+    return ok;
+}
+
+/**
+ * @brief Resolves a "host:port" address for a TCP socket.
+ * 
+ * @param address The address to resolve.
+ * @param result Receives the resolved address.
+ * @param length Receives the length of the resolved address.
+ * @return bool False if the address could not be resolved.
+ */
+bool resolve_address(const string& address, sockaddr_storage& result, socklen_t& length) {
+    size_t colon = address.rfind(':');
+    if (colon == string::npos) {
+        return false;
+    }
+    addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(address.substr(0, colon).c_str(), address.substr(colon + 1).c_str(), &hints, &found) != 0) {
+        return false;
+    }
+    memcpy(&result, found->ai_addr, found->ai_addrlen);
+    length = found->ai_addrlen;
+    freeaddrinfo(found);
+    return true;
+}
+
+/**
+ * @brief Connects every worker to every other worker over TCP.
+ * 
+ * Each worker listens on its own address, connects to every lower rank (retrying until that rank
+ * listens, for up to DIST_CONNECT_TIMEOUT_MS) and announces its rank, then accepts a connection from
+ * every higher rank.
+ * 
+ * @param rank The rank of this worker.
+ * @param addresses The "host:port" address of every rank.
+ * @param peers Receives the socket of every peer, with -1 at this worker's own rank.
+ * @return bool False if the mesh could not be built.
+ */
+bool connect_mesh(int rank, const vector<string>& addresses, vector<int>& peers) {
+    int ranks = (int)addresses.size();
+    peers.assign(ranks, -1);
+    sockaddr_storage address;
+    socklen_t length;
+    if (!resolve_address(addresses[rank], address, length)) {
+        cerr << "Error: cannot resolve " << addresses[rank] << endl;
+        return false;
+    }
+    int listener = socket(address.ss_family, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (listener < 0 || ::bind(listener, (sockaddr*)&address, length) != 0 || listen(listener, ranks) != 0) {
+        cerr << "Error: cannot listen on " << addresses[rank] << endl;
+        return false;
+    }
+
+    for (int r = 0; r < rank; r++) {
+        if (!resolve_address(addresses[r], address, length)) {
+            cerr << "Error: cannot resolve " << addresses[r] << endl;
+            return false;
+        }
+        for (int waited = 0; peers[r] < 0; waited += 10) {
+            int fd = socket(address.ss_family, SOCK_STREAM, 0);
+            if (connect(fd, (sockaddr*)&address, length) == 0) {
+                peers[r] = fd;
+            } else {
+                close(fd);
+                if (waited >= DIST_CONNECT_TIMEOUT_MS) {
+                    cerr << "Error: cannot connect to " << addresses[r] << endl;
+                    return false;
+                }
+                this_thread::sleep_for(milliseconds(10));
+            }
+        }
+        int32_t me = rank;
+        send_all(peers[r], &me, sizeof(me));
+    }
+    for (int accepted = rank + 1; accepted < ranks; accepted++) {
+        int fd = accept(listener, nullptr, nullptr);
+        int32_t them = -1;
+        if (fd < 0 || !recv_all(fd, &them, sizeof(them)) || them <= rank || them >= ranks || peers[them] >= 0) {
+            cerr << "Error: unexpected connection while building the worker mesh" << endl;
+            return false;
+        }
+        peers[them] = fd;
+    }
+    close(listener);
+    return true;
+}
+
+/**
+ * @brief Runs one worker of the distributed samplesort.
+ * 
+ * Implements the "worker" subcommand: ./quicksort_final worker <rank> <input> <output-prefix> <host:port>...
+ * with one address per worker. The worker:
+ * 1. parses its byte range of the input (split at separators) and sorts it locally,
+ * 2. takes DIST_OVERSAMPLE regular samples and shares them with every peer, so that all workers
+ *    pick the same ranks - 1 global splitters from the sorted samples,
+ * 3. cuts its sorted data at the splitters and exchanges the pieces all-to-all, and
+ * 4. merges the sorted pieces it received and writes them to <output-prefix>.part<rank>.csv, ending a
+ *    non-empty part with a newline.
+ * Concatenated in rank order, the parts form the sorted input.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon success and 1 on an error.
+ */
+int worker_command(int argc, char* argv[]) {
+    if (argc < 6) {
+        cerr << "Usage: " << argv[0] << " worker <rank> <input.csv> <output-prefix> <host:port>..." << endl;
+        return 1;
+    }
+    int rank = atoi(argv[2]);
+    string input = argv[3];
+    string output = string(argv[4]) + ".part" + to_string(rank) + ".csv";
+    vector<string> addresses(argv + 5, argv + argc);
+    int ranks = (int)addresses.size();
+    if (rank < 0 || rank >= ranks) {
+        cerr << "Error: rank " << rank << " is not one of the " << ranks << " addresses" << endl;
+        return 1;
+    }
+    vector<int> peers;
+    if (!connect_mesh(rank, addresses, peers)) {
+        return 1;
+    }
+
+    // Load this worker's byte range of the input, moved forward onto separators so no number is split
+    int fd = open(input.c_str(), O_RDONLY);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0) {
+        cerr << "Error opening file " << input << endl;
+        return 1;
+    }
+    size_t size = (size_t)info.st_size;
+    auto boundary = [&](int r) {
+        size_t pos = size * r / ranks;
+        char c;
+        while (pos > 0 && pos < size && pread(fd, &c, 1, (off_t)pos - 1) == 1 && is_number_char(c)) {
+            pos++;  // Move past the number that straddles the boundary
+        }
+        return pos;
+    };
+    size_t begin = boundary(rank);
+    size_t end = boundary(rank + 1);
+    vector<char> text(end - begin + 1);
+    bool loaded = pread(fd, text.data(), end - begin, (off_t)begin) == (ssize_t)(end - begin);
+    close(fd);
+    text[end - begin] = '\0';
+    vector<int> numbers(text.size() / 2 + 1);
+    ParseResult parsed;
+    int count = loaded ? parse_numbers_with_histogram(text, numbers.data(), (int)numbers.size(), input, parsed) : -1;
+    if (count < 0) {
+        return 1;
+    }
+    numbers.resize(count);
+    vector<char>().swap(text);
+    if (count > 0) {
+        SortPlan plan = plan_sort(numbers.data(), count, &parsed);
+        plan.narrow = false;  // The pieces are exchanged in full width
+        sort_numbers(numbers.data(), count, plan, &parsed);
+    }
+
+    // Share regular samples so every worker derives the same splitters
+    vector<vector<int>> outgoing(ranks);
+    vector<vector<int>> incoming;
+    vector<int> samples;
+    for (int s = 0; s < DIST_OVERSAMPLE && count > 0; s++) {
+        samples.push_back(numbers[(size_t)count * s / DIST_OVERSAMPLE]);
+    }
+    for (int r = 0; r < ranks; r++) {
+        outgoing[r] = samples;
+    }
+    if (!exchange_all_to_all(peers, outgoing, incoming)) {
+        cerr << "Error: worker " << rank << " lost a peer while sharing samples" << endl;
+        return 1;
+    }
+    vector<int> all_samples;
+    for (const vector<int>& received : incoming) {
+        all_samples.insert(all_samples.end(), received.begin(), received.end());
+    }
+    sort(all_samples.begin(), all_samples.end());
+    vector<int> splitters;
+    for (int r = 1; r < ranks && !all_samples.empty(); r++) {
+        splitters.push_back(all_samples[all_samples.size() * r / ranks]);
+    }
+
+    // Send every rank the piece of the sorted data that falls between its splitters
+    size_t sent = 0;
+    for (int r = 0; r < ranks; r++) {
+        auto lo = r == 0 || splitters.empty() ? numbers.begin() : upper_bound(numbers.begin(), numbers.end(), splitters[r - 1]);
+        auto hi = r == ranks - 1 || splitters.empty() ? numbers.end() : upper_bound(numbers.begin(), numbers.end(), splitters[r]);
+        if (splitters.empty() && r > 0) {
+            lo = hi;  // Without samples everything stays on rank 0
+        }
+        outgoing[r].assign(lo, hi);
+        sent += r == rank ? 0 : outgoing[r].size();
+    }
+    vector<int>().swap(numbers);
+    if (!exchange_all_to_all(peers, outgoing, incoming)) {
+        cerr << "Error: worker " << rank << " lost a peer during the exchange" << endl;
+        return 1;
+    }
+    for (int peer : peers) {
+        if (peer >= 0) {
+            close(peer);
+        }
+    }
+
+    // Merge the sorted pieces into this worker's part of the output
+    vector<ArrayRunReader*> runs;
+    size_t received = 0;
+    for (const vector<int>& piece : incoming) {
+        runs.push_back(new ArrayRunReader(piece.data(), piece.data() + piece.size()));
+        received += piece.size();
+    }
+    BufferedCsvWriter writer(output);
+    if (!writer.is_open()) {
+        cerr << "Error opening file " << output << endl;
+        return 1;
+    }
+    merge_runs(runs, writer);
+    if (writer.count() > 0) {
+        writer.end_line();  // Keeps the last number of this part apart from the first of the next
+    }
+    for (ArrayRunReader* run : runs) {
+        delete run;
+    }
+    cout << "Worker " << rank << ": sorted " << count << " numbers, sent " << sent << ", wrote " << received
+         << " to " << output << endl;
+    return 0;
+}
+
+/**
+ * @brief Launches a distributed samplesort with local worker processes.
+ * 
+ * Implements the "distributed" subcommand: ./quicksort_final distributed <workers> [input] [output-prefix]
+ * [base-port]. It starts the given number of "worker" processes of this program on 127.0.0.1, at
+ * consecutive ports from DIST_BASE_PORT, splits the OpenMP threads between them unless OMP_NUM_THREADS is
+ * set, and waits for all of them. Workers on other machines can be started with the "worker" subcommand
+ * and the same address list.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 if every worker succeeded and 1 otherwise.
+ */
+int distributed_command(int argc, char* argv[]) {
+    int workers = argc > 2 ? atoi(argv[2]) : 0;
+    if (workers < 1) {
+        cerr << "Usage: " << argv[0] << " distributed <workers> [input.csv] [output-prefix] [base-port]" << endl;
+        return 1;
+    }
+    string input = argc > 3 ? argv[3] : INFILE;
+    string prefix = argc > 4 ? argv[4] : "sorted_numbers";
+    int base_port = argc > 5 ? atoi(argv[5]) : DIST_BASE_PORT;
+    vector<string> args = {"worker", "", input, prefix};
+    for (int r = 0; r < workers; r++) {
+        args.push_back("127.0.0.1:" + to_string(base_port + r));
+    }
+    if (getenv("OMP_NUM_THREADS") == nullptr) {
+        setenv("OMP_NUM_THREADS", to_string(max(1, omp_get_max_threads() / workers)).c_str(), 1);
+    }
+    auto start = high_resolution_clock::now();
+
+    vector<pid_t> children;
+    for (int r = 0; r < workers; r++) {
+        args[1] = to_string(r);
+        vector<char*> child_argv = {argv[0]};
+        for (string& arg : args) {
+            child_argv.push_back(arg.data());
+        }
+        child_argv.push_back(nullptr);
+        pid_t pid = fork();
+        if (pid == 0) {
+            execv("/proc/self/exe", child_argv.data());
+            _exit(127);
+        }
+        if (pid < 0) {
+            cerr << "Error: cannot start worker " << r << endl;
+            for (pid_t child : children) {
+                kill(child, SIGTERM);  // The others would wait for the missing worker until they time out
+            }
+            break;
+        }
+        children.push_back(pid);
+    }
+    int failures = workers - (int)children.size();
+    for (pid_t pid : children) {
+        int status = 0;
+        waitpid(pid, &status, 0);
+        failures += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    duration<double> execution_time = high_resolution_clock::now() - start;
+    if (failures == 0) {
+        cout << "Distributed sort of " << input << " into " << prefix << ".part0.csv to " << prefix << ".part"
+             << workers - 1 << ".csv by " << workers << " workers" << endl;
+    } else {
+        cerr << "Error: " << failures << " of " << workers << " workers failed" << endl;
+    }
+    cout << "Execution time: " << execution_time.count() << " seconds" << endl;
+    return failures == 0 ? 0 : 1;
+}
+
+/**
+ * @brief A request to sort the integers in a shared-memory segment, sent with the segment's fd.
+ */
+struct ShmRequest {
+    uint64_t count;  // Number of 32-bit integers at the start of the segment
+};
+
+/**
+ * @brief The sorter's completion message for a shared-memory request.
+ */
+struct ShmReply {
+    int64_t count;      // Number of integers sorted, or -1 if the segment could not be sorted
+    double seconds;     // Time the sorter spent sorting
+    char engine[16];    // Engine chosen by the planner
+};
+
+/**
+ * @brief Sends a message over a Unix socket together with a file descriptor (SCM_RIGHTS).
+ * 
+ * @param sock The Unix socket.
+ * @param fd The descriptor to pass.
+ * @param data The message.
+ * @param bytes The size of the message.
+ * @return bool False if the message could not be sent.
+ */
+bool send_with_fd(int sock, int fd, const void* data, size_t bytes) {
+    iovec iov = {(void*)data, bytes};
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &fd, sizeof(int));
+    return sendmsg(sock, &message, MSG_NOSIGNAL) == (ssize_t)bytes;
+}
+
+/**
+ * @brief Receives a message over a Unix socket together with the file descriptor passed with it.
+ * 
+ * @param sock The Unix socket.
+ * @param fd Receives the passed descriptor, or -1 if none came with the message or it was short.
+ * @param data The memory receiving the message.
+ * @param bytes The size of the message.
+ * @return bool False if the connection closed or the message was short; a descriptor passed with a short
+ *         message is closed.
+ */
+bool recv_with_fd(int sock, int& fd, void* data, size_t bytes) {
+    iovec iov = {data, bytes};
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr message;
+    memset(&message, 0, sizeof(message));
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    fd = -1;
+    ssize_t got = recvmsg(sock, &message, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+    cmsghdr* header = got > 0 ? CMSG_FIRSTHDR(&message) : nullptr;
+    if (header != nullptr && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS) {
+        memcpy(&fd, CMSG_DATA(header), sizeof(int));
+    }
+    if (got != (ssize_t)bytes) {
+        if (fd >= 0) {
+            close(fd);  // Received with a short message the caller will not act on
+            fd = -1;
+        }
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Fills in the address of a Unix socket.
+ * 
+ * @param path The filesystem path of the socket.
+ * @param address Receives the address.
+ * @return bool False if the path is too long for a Unix socket.
+ */
+bool unix_address(const string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        cerr << "Error: socket path " << path << " is too long" << endl;
+        return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size());
+    return true;
+}
+
+/**
+ * @brief Serves in-place sorts of shared-memory segments handed over a Unix socket.
+ * 
+ * Implements the "shm-serve" subcommand: ./quicksort_final shm-serve <socket-path> [requests]. Producers
+ * connect, then send an ShmRequest with the fd of a memfd holding binary 32-bit integers. The memfd must carry
+ * F_SEAL_SHRINK, or a producer could truncate it mid-sort and kill the sorter with SIGBUS; unsealed segments
+ * are refused. The sorter maps the segment, sorts it in place with the planned engine and answers with an
+ * ShmReply once the sorted integers are visible to the producer, so nothing is copied or parsed. A connection
+ * may send any number of requests. The server stops after the given number of requests, or runs until killed
+ * when it is 0.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon success and 1 on an error.
+ */
+int shm_serve_command(int argc, char* argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: " << argv[0] << " shm-serve <socket-path> [requests]" << endl;
+        return 1;
+    }
+    string path = argv[2];
+    long long limit = argc > 3 ? atoll(argv[3]) : 0;
+    sockaddr_un address;
+    if (!unix_address(path, address)) {
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    if (listener < 0 || ::bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 16) != 0) {
+        cerr << "Error: cannot listen on " << path << endl;
+        return 1;
+    }
+    cout << "Sorting shared-memory segments sent to " << path << endl;
+
+    long long served = 0;
+    while (limit == 0 || served < limit) {
+        int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (connection < 0) {
+            continue;
+        }
+        ShmRequest request;
+        int fd;
+        while ((limit == 0 || served < limit) && recv_with_fd(connection, fd, &request, sizeof(request))) {
+            ShmReply reply;
+            memset(&reply, 0, sizeof(reply));
+            reply.count = -1;
+            struct stat info;
+            size_t bytes = request.count * sizeof(int);
+            int seals = fd >= 0 ? fcntl(fd, F_GET_SEALS) : -1;
+            if (seals < 0 || !(seals & F_SEAL_SHRINK)) {
+                cerr << "Error: request for " << request.count << " integers in a segment not sealed against shrinking" << endl;
+            } else if (fstat(fd, &info) != 0 || (size_t)info.st_size < bytes || request.count > INT_MAX) {
+                cerr << "Error: request for " << request.count << " integers without a large enough segment" << endl;
+            } else {
+                void* segment = bytes > 0 ? mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : nullptr;
+                if (segment == MAP_FAILED) {
+                    cerr << "Error: cannot map a segment of " << bytes << " bytes" << endl;
+                } else {
+                    auto start = high_resolution_clock::now();
+                    int* numbers = (int*)segment;
+                    int count = (int)request.count;
+                    string engine = "none";
+                    if (count > 0) {
+                        SortPlan plan = plan_sort(numbers, count, nullptr);
+                        sort_numbers(numbers, count, plan);
+                        munmap(segment, bytes);
+                        engine = plan.engine;
+                    }
+                    duration<double> sort_time = high_resolution_clock::now() - start;
+                    reply.count = count;
+                    reply.seconds = sort_time.count();
+                    strncpy(reply.engine, engine.c_str(), sizeof(reply.engine) - 1);
+                    cout << "Sorted " << count << " integers in place with " << engine << " in "
+                         << reply.seconds << " seconds" << endl;
+                }
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+            served++;
+            if (!send_all(connection, &reply, sizeof(reply))) {
+                break;
+            }
+        }
+        close(connection);
+    }
+    close(listener);
+    unlink(path.c_str());
+    return 0;
+}
+
+/**
+ * @brief Produces random integers in shared memory and has a running "shm-serve" sorter sort them.
+ * 
+ * Implements the "shm-sort" subcommand: ./quicksort_final shm-sort <socket-path> <n> [output]. The integers
+ * are generated straight into a memfd segment, sealed at its size, whose fd is passed to the sorter. After the
+ * completion message the producer checks the same pages are sorted and optionally writes them as CSV.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon success and 1 on an error.
+ */
+int shm_sort_command(int argc, char* argv[]) {
+    if (argc < 4 || atoi(argv[3]) < 0) {
+        cerr << "Usage: " << argv[0] << " shm-sort <socket-path> <n> [output.csv]" << endl;
+        return 1;
+    }
+    string path = argv[2];
+    int n = atoi(argv[3]);
+    size_t bytes = (size_t)n * sizeof(int);
+    sockaddr_un address;
+    if (!unix_address(path, address)) {
+        return 1;
+    }
+    int fd = memfd_create("quicksort-input", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (fd < 0 || ftruncate(fd, (off_t)bytes) != 0 || fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) != 0) {
+        cerr << "Error: cannot create a shared-memory segment of " << bytes << " bytes" << endl;
+        return 1;
+    }
+    int* numbers = n > 0 ? (int*)mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : nullptr;
+    if (numbers == MAP_FAILED) {
+        cerr << "Error: cannot map a segment of " << bytes << " bytes" << endl;
+        return 1;
+    }
+    srand(time(0));  // Seed the random number generator with the current time
+    generate_random_numbers(numbers, n);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock < 0 || connect(sock, (sockaddr*)&address, sizeof(address)) != 0) {
+        cerr << "Error: no sorter listening on " << path << endl;
+        return 1;
+    }
+    auto start = high_resolution_clock::now();
+    ShmRequest request = {(uint64_t)n};
+    ShmReply reply;
+    if (!send_with_fd(sock, fd, &request, sizeof(request)) || !recv_all(sock, &reply, sizeof(reply))) {
+        cerr << "Error: the sorter on " << path << " closed the connection" << endl;
+        return 1;
+    }
+    duration<double> round_trip = high_resolution_clock::now() - start;
+    close(sock);
+    close(fd);
+    if (reply.count != n || !is_sorted(numbers, numbers + n)) {
+        cerr << "Error: the sorter did not sort the segment" << endl;
+        return 1;
+    }
+    if (argc > 4) {
+        write_numbers_to_file(numbers, n, argv[4]);
+    }
+    if (n > 0) {
+        munmap(numbers, bytes);
+    }
+    cout << "Sorted " << n << " integers in shared memory with " << reply.engine << ": " << reply.seconds
+         << " seconds sorting, " << round_trip.count() - reply.seconds << " seconds handoff" << endl;
+    return 0;
+}
+
+/**
+ * @brief The header of a sort service request or reply; the integers follow it.
+ */
+struct ServiceHeader {
+    uint32_t id;     // Chosen by the client and echoed in the reply
+    uint32_t count;  // Number of 32-bit integers that follow
+};
+
+/**
+ * @brief A client connection of the sort service, closed once no request refers to it.
+ */
+struct ServiceConnection {
+    int fd;
+
+    /**
+     * @brief Closes the socket.
+     */
+    ~ServiceConnection() {
+        close(fd);
+    }
+};
+
+/**
+ * @brief A sort request waiting in the service queue.
+ */
+struct ServiceRequest {
+    shared_ptr<ServiceConnection> connection;          // Where the reply goes
+    ServiceHeader header;                              // The request's id and size
+    vector<int> numbers;                               // The integers to sort
+    high_resolution_clock::time_point arrived;         // When the last byte of the request was read
+};
+
+/**
+ * @brief The state the service shares with its connection readers, which may outlive serve_command.
+ */
+struct ServiceReaders {
+    BoundedQueue<ServiceRequest> queue{SERVICE_QUEUE_DEPTH};  // Requests read ahead of the dispatcher
+    mutex guard;                                             // Guards fds and stopping
+    set<int> fds;                                            // Sockets of connections still being read
+    bool stopping = false;                                   // Set once the service stops accepting requests
+
+    /**
+     * @brief Stops the readers: closes the queue and shuts down every connection still being read.
+     */
+    void stop() {
+        queue.close();
+        lock_guard<mutex> lock(guard);
+        stopping = true;
+        for (int fd : fds) {
+            shutdown(fd, SHUT_RDWR);
+        }
+    }
+};
+
+/**
+ * @brief A high-dynamic-range histogram of latencies with a fixed relative precision.
+ * 
+ * Latencies are counted in nanoseconds. Values below 2^LATENCY_SUB_BITS have a bucket each; above that,
+ * every power of two is split into 2^LATENCY_SUB_BITS linear buckets, so a recorded value is off by less
+ * than 2^-LATENCY_SUB_BITS of itself whatever its magnitude. Recording is a single increment, and the
+ * memory is fixed regardless of how many latencies are recorded.
+ */
+class LatencyHistogram {
+public:
+    /**
+     * @brief Creates an empty histogram covering up to 2^(LATENCY_SUB_BITS + LATENCY_MAX_SHIFT + 1) nanoseconds.
+     */
+    LatencyHistogram() : counts((size_t)(LATENCY_MAX_SHIFT + 2) << LATENCY_SUB_BITS, 0) {}
+
+    /**
+     * @brief Counts one latency. Latencies beyond the range are counted in the last bucket.
+     * 
+     * @param seconds The latency.
+     */
+    void record(double seconds) {
+        uint64_t ns = seconds > 0 ? (uint64_t)(seconds * 1e9) : 0;
+        counts[min(index_of(ns), counts.size() - 1)]++;
+        total++;
+        sum += ns;
+        largest = max(largest, ns);
+    }
+
+    /**
+     * @brief Adds the counts of another histogram.
+     * 
+     * @param other The histogram to add.
+     */
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts.size(); i++) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        sum += other.sum;
+        largest = max(largest, other.largest);
+    }
+
+    /**
+     * @brief Returns the number of latencies recorded.
+     * 
+     * @return uint64_t The count.
+     */
+    uint64_t count() const {
+        return total;
+    }
+
+    /**
+     * @brief Returns the latency below or at which the given fraction of the recorded latencies fall.
+     * 
+     * @param fraction The quantile, e.g. 0.999 for p99.9.
+     * @return double The latency in seconds, rounded up to its bucket's upper end, or 0 when nothing was recorded.
+     */
+    double quantile(double fraction) const {
+        uint64_t rank = max<uint64_t>(1, (uint64_t)ceil(fraction * total));
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size() && total > 0; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return min(upper_end(i), largest) * 1e-9;
+            }
+        }
+        return 0;
+    }
+
+    /**
+     * @brief Returns the mean latency.
+     * 
+     * @return double The mean in seconds, or 0 when nothing was recorded.
+     */
+    double mean() const {
+        return total > 0 ? (double)sum / total * 1e-9 : 0;
+    }
+
+    /**
+     * @brief Returns the largest latency recorded.
+     * 
+     * @return double The maximum in seconds.
+     */
+    double max_value() const {
+        return largest * 1e-9;
+    }
+
+private:
+    vector<uint64_t> counts;  // Recorded latencies per bucket
+    uint64_t total = 0;       // Number of latencies recorded
+    uint64_t sum = 0;         // Sum of the recorded latencies in nanoseconds
+    uint64_t largest = 0;     // Largest latency recorded in nanoseconds
+
+    /**
+     * @brief Returns the bucket of a latency.
+     * 
+     * @param ns The latency in nanoseconds.
+     * @return size_t The bucket index.
+     */
+    static size_t index_of(uint64_t ns) {
+        if (ns < (1ULL << LATENCY_SUB_BITS)) {
+            return (size_t)ns;
+        }
+        int shift = 63 - __builtin_clzll(ns) - LATENCY_SUB_BITS;
+        return ((size_t)(shift + 1) << LATENCY_SUB_BITS) + (size_t)((ns >> shift) - (1ULL << LATENCY_SUB_BITS));
+    }
+
+    /**
+     * @brief Returns the largest latency that falls in a bucket.
+     * 
+     * @param index The bucket index.
+     * @return uint64_t The latency in nanoseconds.
+     */
+    static uint64_t upper_end(size_t index) {
+        if (index < (1ULL << LATENCY_SUB_BITS)) {
+            return index;
+        }
+        int shift = (int)(index >> LATENCY_SUB_BITS) - 1;
+        uint64_t mantissa = (index & ((1ULL << LATENCY_SUB_BITS) - 1)) + (1ULL << LATENCY_SUB_BITS);
+        return ((mantissa + 1) << shift) - 1;
+    }
+};
+
+/**
+ * @brief Names the size class of a request: up to 16, 256, 4K, 64K or 1M integers, or more.
+ * 
+ * @param n The number of integers in the request.
+ * @return string The size class.
+ */
+string size_class(size_t n) {
+    static const char* names[] = {"<=16", "<=256", "<=4K", "<=64K", "<=1M"};
+    size_t limit = 16;
+    for (const char* name : names) {
+        if (n <= limit) {
+            return name;
+        }
+        limit *= 16;
+    }
+    return ">1M";
+}
+
+/**
+ * @brief Prints one line of count, mean, p50, p99, p99.9 and maximum latency per histogram.
+ * 
+ * @param histograms The histograms by request type and size class.
+ */
+void print_latency_table(const map<string, LatencyHistogram>& histograms) {
+    for (const auto& [name, histogram] : histograms) {
+        cout << "  " << name << ": " << histogram.count() << " requests, mean " << histogram.mean() * 1e6
+             << " us, p50 " << histogram.quantile(0.50) * 1e6 << " us, p99 " << histogram.quantile(0.99) * 1e6
+             << " us, p99.9 " << histogram.quantile(0.999) * 1e6 << " us, max " << histogram.max_value() * 1e6
+             << " us" << endl;
+    }
+}
+
+/**
+ * @brief Runs a long-lived sort service on a Unix socket.
+ * 
+ * Implements the "serve" subcommand: ./quicksort_final serve [--window-us=N] [--large=N] [flags] <socket-path>
+ * [requests]. Each client request is a ServiceHeader followed by its integers, and is answered on the same
+ * connection with the same header and the integers sorted; a connection may have many requests in flight.
+ * A header announcing more than SERVICE_MAX_REQUEST integers closes the connection, so a client cannot make
+ * the service allocate arbitrary memory. One thread per connection reads requests into a queue, and the
+ * dispatcher:
+ * - sends a request of at least --large integers (default SERVICE_LARGE) to the planned parallel engine
+ *   straight away, and
+ * - holds a smaller one for up to --window-us microseconds (default SERVICE_WINDOW_US) while other small
+ *   requests arrive, up to SERVICE_BATCH_MAX integers, then sorts the whole batch as one segmented sort
+ *   with a task per request, so the OpenMP team starts once for many requests.
+ * Latency from arrival to reply is recorded in a LatencyHistogram per request type ("batch" or the engine)
+ * and size class. After the given number of requests (or never, when it is 0) it shuts down the listener and
+ * every connection still being read, then prints the batching, throughput and latency table and exits.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon success and 1 on an error.
+ */
+int serve_command(int argc, char* argv[]) {
+    long long window_us = SERVICE_WINDOW_US;
+    size_t large = SERVICE_LARGE;
+    int first = 2;
+    for (; first < argc && string(argv[first]).rfind("--", 0) == 0; first++) {
+        string arg = argv[first];
+        if (arg.rfind("--window-us=", 0) == 0) {
+            window_us = max(0LL, atoll(arg.c_str() + 12));
+        } else if (arg.rfind("--large=", 0) == 0) {
+            large = max(1LL, atoll(arg.c_str() + 8));
+        } else if (!parse_option(arg)) {
+            cerr << "Error: Unknown option " << arg << endl;
+            return 1;
+        }
+    }
+    if (options.head > 0) {
+        cerr << "Error: --head is not supported by serve, which always returns every integer." << endl;
+        return 1;
+    }
+    start_metrics_exporters();
+    install_stats_handler();
+    if (first >= argc) {
+        cerr << "Usage: " << argv[0] << " serve [--window-us=N] [--large=N] [flags] <socket-path> [requests]" << endl;
+        return 1;
+    }
+    string path = argv[first];
+    long long limit = first + 1 < argc ? atoll(argv[first + 1]) : 0;
+    sockaddr_un address;
+    if (!unix_address(path, address)) {
+        return 1;
+    }
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    unlink(path.c_str());
+    if (listener < 0 || ::bind(listener, (sockaddr*)&address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+        cerr << "Error: cannot listen on " << path << endl;
+        return 1;
+    }
+    cout << "Sort service on " << path << " (window " << window_us << " us, large from " << large << " integers)" << endl;
+    enter_phase("serving", (uint64_t)limit, "requests answered");
+
+    // Readers own the shared state, so one still finishing a recv after the service returns touches nothing freed
+    auto readers = make_shared<ServiceReaders>();
+    BoundedQueue<ServiceRequest>& queue = readers->queue;
+    thread acceptor([readers, listener] {
+        for (;;) {
+            int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                return;
+            }
+            auto connection = make_shared<ServiceConnection>();
+            connection->fd = fd;
+            {
+                lock_guard<mutex> lock(readers->guard);
+                if (readers->stopping) {
+                    return;
+                }
+                readers->fds.insert(fd);
+            }
+            thread([readers, connection] {
+                BoundedQueue<ServiceRequest>& queue = readers->queue;
+                ServiceRequest request;
+                while (recv_all(connection->fd, &request.header, sizeof(request.header))) {
+                    if (request.header.count > SERVICE_MAX_REQUEST) {
+                        cerr << "Error: dropping a connection that sent a request of " << request.header.count
+                             << " integers" << endl;
+                        break;
+                    }
+                    request.numbers.resize(request.header.count);
+                    if (!recv_all(connection->fd, request.numbers.data(), request.header.count * sizeof(int))) {
+                        break;
+                    }
+                    request.connection = connection;
+                    request.arrived = high_resolution_clock::now();
+                    queue.push(move(request));
+                    request = ServiceRequest();
+                }
+                lock_guard<mutex> lock(readers->guard);
+                readers->fds.erase(connection->fd);
+            }).detach();
+        }
+    });
+
+    map<string, LatencyHistogram> latencies;
+    long long served = 0, batches = 0, batched = 0, direct = 0;
+    size_t sorted_integers = 0;
+    high_resolution_clock::time_point started;
+    auto reply = [&](ServiceRequest& request, const string& type) {
+        send_all(request.connection->fd, &request.header, sizeof(request.header));
+        send_all(request.connection->fd, request.numbers.data(), request.numbers.size() * sizeof(int));
+        duration<double> latency = high_resolution_clock::now() - request.arrived;
+        latencies[type + " " + size_class(request.numbers.size())].record(latency.count());
+        latencies["all"].record(latency.count());
+        phase_progress.done.fetch_add(1, memory_order_relaxed);
+        sorted_integers += request.numbers.size();
+        served++;
+    };
+
+    ServiceRequest request;
+    while ((limit == 0 || served < limit) && queue.pop(request)) {
+        if (served == 0) {
+            started = request.arrived;
+        }
+        vector<ServiceRequest> batch, bulk;
+        size_t batch_integers = 0;
+        auto add = [&](ServiceRequest& item) {
+            if (item.numbers.size() >= large) {
+                bulk.push_back(move(item));
+            } else {
+                batch_integers += item.numbers.size();
+                batch.push_back(move(item));
+            }
+        };
+        add(request);
+        if (!batch.empty()) {
+            auto deadline = batch[0].arrived + microseconds(window_us);
+            while (batch_integers < SERVICE_BATCH_MAX && queue.pop_until(request, deadline)) {
+                add(request);
+            }
+        }
+
+        if (!batch.empty()) {
+            // One segmented sort: a task per request on a single OpenMP team
+            #pragma omp parallel
+            {
+                #pragma omp single
+                for (size_t i = 0; i < batch.size(); i++) {
+                    int* numbers = batch[i].numbers.data();
+                    int count = (int)batch[i].numbers.size();
+                    #pragma omp task firstprivate(numbers, count)
+                    {
+                        uint64_t start = metrics_now_ns();
+                        if (count <= NETWORK_MAX) {
+                            network_sort_numbers(numbers, count);
+                        } else {
+                            quickSort(numbers, 0, count - 1);
+                        }
+                        count_task(start);
+                    }
+                }
+            }
+            batches++;
+            batched += batch.size();
+            count_sort("batch", batch_integers);
+            for (ServiceRequest& item : batch) {
+                reply(item, "batch");
+            }
+        }
+        for (ServiceRequest& item : bulk) {
+            SortPlan plan = plan_sort(item.numbers.data(), item.numbers.size(), nullptr);
+            sort_numbers(item.numbers.data(), (int)item.numbers.size(), plan);
+            direct++;
+            reply(item, plan.engine);
+        }
+    }
+    readers->stop();
+    shutdown(listener, SHUT_RDWR);
+    acceptor.join();
+    close(listener);
+    unlink(path.c_str());
+
+    duration<double> elapsed = high_resolution_clock::now() - started;
+    cout << "Served " << served << " requests: " << batched << " in " << batches << " coalesced batches ("
+         << (batches > 0 ? (double)batched / batches : 0) << " per batch), " << direct << " on the parallel engine" << endl;
+    cout << "Throughput: " << served / elapsed.count() << " requests/s, " << sorted_integers / elapsed.count()
+         << " integers/s" << endl;
+    cout << "Latency by request type and size:" << endl;
+    print_latency_table(latencies);
+    return 0;
+}
+
+/**
+ * @brief Loads a running sort service from several client connections and reports the latency it sees.
+ * 
+ * Implements the "serve-bench" subcommand: ./quicksort_final serve-bench [--rate=R] <socket-path> <clients>
+ * <requests> <mix>. The mix is a request size, or a weighted list such as "100:90,10000:9,500000:1", from
+ * which every request draws its size. Each client thread opens its own connection and sends the given
+ * number of requests of random integers:
+ * - closed loop (default): one request at a time, each sent when the previous reply arrives, checking
+ *   the reply is the sorted request, and
+ * - open loop (--rate): Poisson arrivals at R requests per second across all clients, sent on schedule
+ *   whether or not earlier replies came back. Latency counts from the scheduled send time, so a
+ *   saturated service shows up as queueing delay instead of a slower request rate.
+ * Raising --rate until the achieved throughput stops following it finds the saturation throughput.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 if every reply was correct and 1 otherwise.
+ */
+int serve_bench_command(int argc, char* argv[]) {
+    double rate = 0;
+    int first = 2;
+    for (; first < argc && string(argv[first]).rfind("--", 0) == 0; first++) {
+        string arg = argv[first];
+        if (arg.rfind("--rate=", 0) == 0) {
+            rate = max(0.0, atof(arg.c_str() + 7));
+        } else {
+            cerr << "Error: Unknown option " << arg << endl;
+            return 1;
+        }
+    }
+    if (argc - first < 4) {
+        cerr << "Usage: " << argv[0] << " serve-bench [--rate=R] <socket-path> <clients> <requests> <size|size:weight,...>" << endl;
+        return 1;
+    }
+    string path = argv[first];
+    int clients = max(1, atoi(argv[first + 1]));
+    int requests = max(0, atoi(argv[first + 2]));
+    vector<int> sizes;
+    vector<double> weights;
+    stringstream mix(argv[first + 3]);
+    for (string entry; getline(mix, entry, ',');) {
+        size_t colon = entry.find(':');
+        sizes.push_back(max(0, atoi(entry.c_str())));
+        weights.push_back(colon == string::npos ? 1.0 : atof(entry.c_str() + colon + 1));
+    }
+    sockaddr_un address;
+    if (sizes.empty() || !unix_address(path, address)) {
+        return 1;
+    }
+
+    vector<map<string, LatencyHistogram>> histograms(clients);
+    atomic<int> failures(0);
+    auto start = high_resolution_clock::now();
+    vector<thread> threads;
+    for (int c = 0; c < clients; c++) {
+        threads.emplace_back([&, c] {
+            int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if (sock < 0 || connect(sock, (sockaddr*)&address, sizeof(address)) != 0) {
+                failures++;
+                return;
+            }
+            mt19937 random(c + 1);
+            discrete_distribution<int> pick(weights.begin(), weights.end());
+            vector<int> numbers, sorted;
+            auto send_request = [&](uint32_t id) {
+                numbers.resize(sizes[pick(random)]);
+                for (int& value : numbers) {
+                    value = (int)(random() % 1000);
+                }
+                ServiceHeader header = {id, (uint32_t)numbers.size()};
+                return send_all(sock, &header, sizeof(header)) && send_all(sock, numbers.data(), numbers.size() * sizeof(int));
+            };
+            auto receive_reply = [&](ServiceHeader& header) {
+                if (!recv_all(sock, &header, sizeof(header))) {
+                    return false;
+                }
+                sorted.resize(header.count);
+                return recv_all(sock, sorted.data(), sorted.size() * sizeof(int));
+            };
+            auto record = [&](size_t n, double latency) {
+                histograms[c][size_class(n)].record(latency);
+                histograms[c]["all"].record(latency);
+            };
+
+            if (rate == 0) {
+                for (int r = 0; r < requests; r++) {
+                    auto sent = high_resolution_clock::now();
+                    ServiceHeader header;
+                    if (!send_request(r) || !receive_reply(header) || header.id != (uint32_t)r) {
+                        failures++;
+                        break;
+                    }
+                    duration<double> latency = high_resolution_clock::now() - sent;
+                    record(sorted.size(), latency.count());
+                    sort(numbers.begin(), numbers.end());
+                    failures += numbers != sorted;
+                }
+            } else {
+                // Schedule every send up front so a slow reply never delays the next request
+                vector<high_resolution_clock::time_point> scheduled(requests);
+                exponential_distribution<double> gap(rate / clients);
+                auto at = high_resolution_clock::now();
+                for (int r = 0; r < requests; r++) {
+                    at += duration_cast<high_resolution_clock::duration>(duration<double>(gap(random)));
+                    scheduled[r] = at;
+                }
+                thread sender([&] {
+                    for (int r = 0; r < requests; r++) {
+                        this_thread::sleep_until(scheduled[r]);
+                        if (!send_request(r)) {
+                            failures++;
+                            shutdown(sock, SHUT_RDWR);  // Wake the receiver waiting for replies that will not come
+                            break;
+                        }
+                    }
+                });
+                for (int r = 0; r < requests; r++) {
+                    ServiceHeader header;
+                    if (!receive_reply(header) || header.id >= (uint32_t)requests) {
+                        failures++;
+                        shutdown(sock, SHUT_RDWR);  // Stop the sender too, which the unread replies could block
+                        break;
+                    }
+                    duration<double> latency = high_resolution_clock::now() - scheduled[header.id];
+                    record(sorted.size(), latency.count());
+                    failures += !is_sorted(sorted.begin(), sorted.end());
+                }
+                sender.join();
+            }
+            close(sock);
+        });
+    }
+    for (thread& client : threads) {
+        client.join();
+    }
+    duration<double> elapsed = high_resolution_clock::now() - start;
+
+    map<string, LatencyHistogram> merged;
+    for (const map<string, LatencyHistogram>& client : histograms) {
+        for (const auto& [name, histogram] : client) {
+            merged[name].merge(histogram);
+        }
+    }
+    uint64_t completed = merged["all"].count();
+    cout << clients << (rate == 0 ? " closed-loop" : " open-loop") << " clients sent " << completed << " requests";
+    if (rate > 0) {
+        cout << " at " << rate << " requests/s offered";
+    }
+    cout << endl;
+    cout << "Throughput: " << completed / elapsed.count() << " requests/s" << endl;
+    print_latency_table(merged);
+    if (failures > 0) {
+        cerr << "Error: " << failures << " requests failed or came back unsorted" << endl;
+    }
+    return failures > 0 ? 1 : 0;
+}
+
+/**
+ * @brief The main function that drives the program.
+ * 
+ * This function generates random integers, writes them to a file, reads them back from the file,
+ * sorts them in parallel, and then writes the sorted integers to another file. The number of integers 
+ * to generate can be specified via command-line arguments. If no argument is provided, a default value 
+ * of 25 is used. Flags such as --engine=radix select how the numbers are sorted. The "merge" subcommand
+ * instead merges already sorted CSV files, "bench-radix" benchmarks the radix scatter, and "tune" writes a
+ * machine-specific tuning profile that every later run loads. "topology" prints the detected caches and cores,
+ * "bandwidth" measures the peak memory bandwidth used by --roofline, and "bench-prefetch" times the
+ * software prefetch distances. "set" intersects, unites or subtracts two sorted files, "batch"
+ * sorts many files in one process, "distributed" runs a samplesort across worker processes, and "shm-serve"
+ * sorts shared-memory segments that "shm-sort" producers hand over a Unix socket. "serve" runs a sort service
+ * that batches small requests, and "serve-bench" loads it from several clients.
+ * 
+ * @param argc The number of command-line arguments.
+ * @param argv The command-line arguments.
+ * @return int Returns 0 upon successful execution.
+ */
+int main(int argc, char* argv[]) {
+    detect_topology();
+    apply_topology_defaults();
+    if (argc > 1 && string(argv[1]) == "topology") {
+        return topology_command();
+    }
+    if (argc > 1 && string(argv[1]) == "tune") {
+        return tune_command(argc, argv);
+    }
+    if (load_tuning_profile(TUNING_FILE)) {
+        cout << "Loaded tuning profile " << TUNING_FILE << endl;
+    }
+
+    if (argc > 1 && string(argv[1]) == "merge") {
+        return merge_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "serve") {
+        return serve_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "serve-bench") {
+        return serve_bench_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "shm-serve") {
+        return shm_serve_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "shm-sort") {
+        return shm_sort_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "distributed") {
+        return distributed_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "worker") {
+        return worker_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "batch") {
+        return batch_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "set") {
+        return set_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "bench-radix") {
+        return bench_radix_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "bench-prefetch") {
+        return bench_prefetch_command(argc, argv);
+    }
+    if (argc > 1 && string(argv[1]) == "bandwidth") {
+        return bandwidth_command();
+    }
+
+    srand(time(0));  // Seed the random number generator with the current time
+
+    // Determine the number of integers to generate
+    int n = N;  // Default value of N
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.rfind("--", 0) == 0) {
+            if (!parse_option(arg)) {
+                cerr << "Error: Unknown option " << arg << endl;
+                return 1;
+            }
+            continue;
+        }
+        try {
+            n = stoi(arg);  // Convert the argument to an integer
+        } catch (exception &err) {
+            cerr << "Error: The number of integers to generate must be an integer." << endl;
+            return 1;  // Exit the program with an error code
+        }
+    }
+    start_metrics_exporters();
+    install_stats_handler();
+
+    if (options.pipeline && !options.bitmap.empty()) {
+        cerr << "Error: --pipeline cannot be combined with --bitmap." << endl;
+        return 1;
+    }
+    if (options.unique_counts && !options.bitmap.empty()) {
+        cerr << "Error: --unique=counts cannot be combined with --bitmap, which does not keep counts." << endl;
+        return 1;
+    }
+    if (options.head > 0 && (options.pipeline || !options.bitmap.empty())) {
+        cerr << "Error: --head cannot be combined with " << (options.pipeline ? "--pipeline." : "--bitmap.") << endl;
+        return 1;
+    }
+
+    cout << "Generating " << n << " random integers" << endl;
+
+    // Dynamically allocate memory for the array, unless the array alone would exceed --memory-limit
+    size_t limit = options.memory_limit;
+    size_t baseline = peak_rss_bytes();
+    bool resident = limit == 0 || 4 * (size_t)n + baseline + RUN_BUFFER_SIZE + tuning.write_buffer_bytes <= limit;
+    int* numbers = resident ? new int[n] : nullptr;
+
+    // Record the start time
+    auto start = high_resolution_clock::now();
+
+    auto phase_start = high_resolution_clock::now();
+    if (resident) {
+        // Generate random numbers
+        enter_phase("generate");
+        generate_random_numbers(numbers, n);
+        record_phase("generate", phase_start, 4.0 * n);
+
+        // Write the generated integers to a file
+        phase_start = high_resolution_clock::now();
+        enter_phase("write input");
+        write_numbers_to_file(numbers, n, INFILE);
+        record_phase("write input", phase_start, 4.0 * n + file_size(INFILE));
+    } else {
+        // Generate the integers straight into the file
+        enter_phase("generate + write input", (uint64_t)n, "integers");
+        generate_numbers_to_file(n, INFILE);
+        record_phase("generate + write input", phase_start, file_size(INFILE));
+    }
+
+    // Decide whether the input is sorted in memory, with narrowed keys, or externally
+    MemoryPlan memory = plan_memory(n, (size_t)file_size(INFILE), limit, baseline);
+    if (memory.strategy == "external" && !options.bitmap.empty()) {
+        cerr << "Error: --bitmap needs the whole input in memory, which exceeds --memory-limit." << endl;
+        delete[] numbers;
+        return 1;
+    }
+    if (memory.strategy == "external" && options.head > 0) {
+        cerr << "Error: --head needs the whole input in memory, which exceeds --memory-limit." << endl;
+        delete[] numbers;
+        return 1;
+    }
+
+    bool streamed = memory.strategy == "external" || options.pipeline;  // Sorted straight from file to file
+    ParseResult parsed;
+    bool fused = memory.strategy == "in-memory" &&
+                 (options.narrow || options.engine != "quicksort" || !options.bitmap.empty());
+    int count = 0;
+    SortPlan plan;
+    if (memory.strategy == "external") {
+        // Sort runs that fit the budget and merge them into the output
+        delete[] numbers;
+        numbers = nullptr;
+        phase_start = high_resolution_clock::now();
+        count = external_sort_file(INFILE, OUTFILE, memory);
+        record_phase("external sort", phase_start, (2.0 + 2.0 * memory.passes) * file_size(INFILE));
+    } else if (options.pipeline) {
+        // Parse, sort, merge and write on overlapping stage threads
+        delete[] numbers;
+        numbers = nullptr;
+        phase_start = high_resolution_clock::now();
+        enter_parsing_phase("pipeline", (uint64_t)file_size(INFILE));
+        count = pipeline_sort_file(INFILE, OUTFILE);
+        record_phase("pipeline", phase_start, 2.0 * file_size(INFILE) + 12.0 * max(count, 0));
+    } else {
+        // Read the generated integers from file, gathering radix statistics while parsing when they will be used
+        phase_start = high_resolution_clock::now();
+        enter_parsing_phase("read", (uint64_t)file_size(INFILE));
+        count = fused ? read_numbers_with_histogram(numbers, n, INFILE, parsed) : read_numbers_from_file(numbers, INFILE);
+        record_phase("read", phase_start, file_size(INFILE) + 4.0 * max(count, 0));
+    }
+    if (count < 0) {
+        delete[] numbers;
+        return 1;  // The reader has reported why
+    }
+    if (count > 0 && options.bitmap.empty() && !streamed && options.head > 0) {
+        // Only the first values are wanted, which the in-place incremental quicksort produces in any budget
+        plan.engine = "incremental";
+        plan.rationale = "--head=" + to_string(options.head) + " partitions only as far as the first values need";
+    } else if (count > 0 && options.bitmap.empty() && !streamed) {
+        // Probe the input and choose how to sort it
+        plan = plan_sort(numbers, count, fused ? &parsed : nullptr);
+        if (memory.strategy == "narrowed") {
+            fit_plan_to_budget(plan, numbers, count, memory.available);
+        }
+    }
+    if (streamed) {
+        // Already sorted and written
+    } else if (count > 0 && !options.bitmap.empty()) {
+        // Write the distinct integers in order straight from a bitmap
+        phase_start = high_resolution_clock::now();
+        enter_phase("bitmap + write output");
+        bitmap_write_numbers(numbers, count, OUTFILE, options.bitmap, &parsed);
+        record_phase("bitmap + write output", phase_start, 4.0 * count + file_size(OUTFILE));
+    } else if (count > 0 && plan.narrow) {
+        // Sort narrowed keys and widen them back while writing the output
+        phase_start = high_resolution_clock::now();
+        enter_phase("sort + write output");
+        narrow_sort_and_write_numbers(numbers, count, OUTFILE, &parsed);
+        record_phase("sort + write output", phase_start,
+                     estimate_sort_traffic(plan, count, fused ? &parsed : nullptr) + file_size(OUTFILE));
+    } else if (count > 0 && plan.engine == "incremental") {
+        // Sort only as much of the array as the requested head needs
+        phase_start = high_resolution_clock::now();
+        enter_phase("partial sort + write output");
+        write_sorted_head(numbers, count, options.head, OUTFILE);
+        record_phase("partial sort + write output", phase_start, 8.0 * count + file_size(OUTFILE));
+    } else if (count > 0 && options.early_emit && plan.engine == "quicksort") {
+        // Write the sorted prefix while the rest of the array is still being sorted
+        phase_start = high_resolution_clock::now();
+        enter_phase("sort + write output");
+        sort_and_stream_numbers(numbers, count, plan, OUTFILE);
+        record_phase("sort + write output", phase_start,
+                     estimate_sort_traffic(plan, count, fused ? &parsed : nullptr) + file_size(OUTFILE));
+    } else if (count > 0) {
+        // Sort numbers from array with the chosen engine
+        phase_start = high_resolution_clock::now();
+        enter_phase("sort");
+        sort_numbers(numbers, count, plan, fused ? &parsed : nullptr);
+        record_phase("sort", phase_start, estimate_sort_traffic(plan, count, fused ? &parsed : nullptr));
+
+        // Write the sorted integers to a file, collapsing duplicates on the way if requested
+        phase_start = high_resolution_clock::now();
+        enter_phase("write output");
+        if (options.unique) {
+            write_unique_numbers_to_file(numbers, count, OUTFILE, options.unique_counts);
+        } else {
+            write_numbers_to_file(numbers, count, OUTFILE);
+        }
+        record_phase("write output", phase_start, 4.0 * count + file_size(OUTFILE));
+    }
+
+    // Record the end time
+    auto end = high_resolution_clock::now();
+
+    // Calculate the elapsed time in seconds as a double
+    duration<double> execution_time = (end - start);
+    if (limit > 0) {
+        cout << "Memory plan: " << memory.strategy << ", " << memory.rationale << endl;
+        cout << "Peak memory: " << (peak_rss_bytes() >> 20) << " MiB of a " << (limit >> 20) << " MiB budget" << endl;
+    }
+    if (count > 0 && options.bitmap.empty() && !streamed) {
+        cout << "Sort plan: " << (plan.narrow ? "narrowed radix" : plan.engine) << " on " << plan.threads
+             << " threads, " << plan.rationale << endl;
+    }
+    if (options.roofline) {
+        // Compare every phase against the machine's peak memory bandwidth
+        double peak = tuning.peak_bandwidth_gbs > 0 ? tuning.peak_bandwidth_gbs : measure_peak_bandwidth();
+        report_phases(peak);
+    }
     cout << "Execution time: " << execution_time.count() << " seconds" << endl;
 
     // Clean up dynamically allocated memory